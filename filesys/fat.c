@@ -24,18 +24,22 @@ struct fat_fs {
 	disk_sector_t data_start;
 	cluster_t last_clst;
 	struct lock write_lock;
+	struct list indexes;    /* Chain indexes, see fat_index_init(). */
 };
 
 static struct fat_fs *fat_fs;
 
 void fat_boot_create (void);
 void fat_fs_init (void);
+static void fat_index_invalidate (cluster_t clst);
 
 void
 fat_init (void) {
 	fat_fs = calloc (1, sizeof (struct fat_fs));
 	if (fat_fs == NULL)
 		PANIC ("FAT init failed");
+	lock_init (&fat_fs->write_lock);
+	list_init (&fat_fs->indexes);
 
 	// Read boot sector from the disk
 	unsigned int *bounce = malloc (DISK_SECTOR_SIZE);
@@ -153,6 +157,10 @@ fat_boot_create (void) {
 void
 fat_fs_init (void) {
 	/* TODO: Your code goes here. */
+	fat_fs->data_start = fat_fs->bs.fat_start + fat_fs->bs.fat_sectors;
+	fat_fs->fat_length = (fat_fs->bs.total_sectors - fat_fs->data_start)
+		/ SECTORS_PER_CLUSTER + 1;
+	fat_fs->last_clst = ROOT_DIR_CLUSTER;
 }
 
 /*----------------------------------------------------------------------------*/
@@ -165,6 +173,28 @@ fat_fs_init (void) {
 cluster_t
 fat_create_chain (cluster_t clst) {
 	/* TODO: Your code goes here. */
+	cluster_t new = 0;
+
+	lock_acquire (&fat_fs->write_lock);
+	/* Look from where the last one was found, so that a growing chain
+	 * tends to be contiguous. */
+	for (unsigned i = 0; i < fat_fs->fat_length - 1; i++) {
+		cluster_t c = (fat_fs->last_clst + i) % (fat_fs->fat_length - 1) + 1;
+		if (fat_fs->fat[c] == 0) {
+			new = c;
+			break;
+		}
+	}
+	if (new != 0) {
+		fat_fs->fat[new] = EOChain;
+		if (clst != 0) {
+			fat_index_invalidate (clst);
+			fat_fs->fat[clst] = new;
+		}
+		fat_fs->last_clst = new;
+	}
+	lock_release (&fat_fs->write_lock);
+	return new;
 }
 
 /* Remove the chain of clusters starting from CLST.
@@ -172,22 +202,175 @@ fat_create_chain (cluster_t clst) {
 void
 fat_remove_chain (cluster_t clst, cluster_t pclst) {
 	/* TODO: Your code goes here. */
+	lock_acquire (&fat_fs->write_lock);
+	fat_index_invalidate (pclst != 0 ? pclst : clst);
+	if (pclst != 0)
+		fat_fs->fat[pclst] = EOChain;
+	while (clst != 0 && clst != EOChain) {
+		cluster_t next = fat_fs->fat[clst];
+		fat_fs->fat[clst] = 0;
+		clst = next;
+	}
+	lock_release (&fat_fs->write_lock);
 }
 
 /* Update a value in the FAT table. */
 void
 fat_put (cluster_t clst, cluster_t val) {
 	/* TODO: Your code goes here. */
+	ASSERT (clst > 0 && clst < fat_fs->fat_length);
+	lock_acquire (&fat_fs->write_lock);
+	fat_index_invalidate (clst);
+	fat_fs->fat[clst] = val;
+	lock_release (&fat_fs->write_lock);
 }
 
 /* Fetch a value in the FAT table. */
 cluster_t
 fat_get (cluster_t clst) {
 	/* TODO: Your code goes here. */
+	cluster_t val;
+
+	ASSERT (clst > 0 && clst < fat_fs->fat_length);
+	lock_acquire (&fat_fs->write_lock);
+	val = fat_fs->fat[clst];
+	lock_release (&fat_fs->write_lock);
+	return val;
 }
 
 /* Covert a cluster # to a sector number. */
 disk_sector_t
 cluster_to_sector (cluster_t clst) {
 	/* TODO: Your code goes here. */
+	ASSERT (clst > 0 && clst < fat_fs->fat_length);
+	return fat_fs->data_start + (clst - 1) * SECTORS_PER_CLUSTER;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Chain index                                                                */
+/*----------------------------------------------------------------------------*/
+
+/* Walking a chain to find its Nth cluster takes N FAT lookups. A chain
+ * index keeps the chain as runs of consecutive clusters instead, built
+ * on first use, so that the Nth cluster is a binary search over the runs.
+ * Every index is on the FAT's list, and a change to a chain marks stale
+ * only the indexes of that chain, which are rebuilt on their next lookup.
+ * Indexes are protected by the FAT's write_lock. */
+
+/* Returns true if CLST is one of the clusters INDEX's runs hold. */
+static bool
+fat_index_contains (const struct fat_index *index, cluster_t clst) {
+	for (size_t i = 0; i < index->run_cnt; i++)
+		if (clst >= index->runs[i].clst
+				&& clst - index->runs[i].clst < index->runs[i].cnt)
+			return true;
+	return false;
+}
+
+/* Marks stale the indexes of the chain CLST is in, which is about to
+ * change. */
+static void
+fat_index_invalidate (cluster_t clst) {
+	struct list_elem *e;
+
+	ASSERT (lock_held_by_current_thread (&fat_fs->write_lock));
+	for (e = list_begin (&fat_fs->indexes); e != list_end (&fat_fs->indexes);
+			e = list_next (e)) {
+		struct fat_index *index = list_entry (e, struct fat_index, elem);
+		if (index->valid && fat_index_contains (index, clst))
+			index->valid = false;
+	}
+}
+
+/* Starts INDEX for the chain that starts at HEAD, or none if 0. */
+void
+fat_index_init (struct fat_index *index, cluster_t head) {
+	index->head = head;
+	index->runs = NULL;
+	index->run_cnt = 0;
+	index->valid = false;
+	lock_acquire (&fat_fs->write_lock);
+	list_push_back (&fat_fs->indexes, &index->elem);
+	lock_release (&fat_fs->write_lock);
+}
+
+/* Frees INDEX's runs. */
+void
+fat_index_destroy (struct fat_index *index) {
+	lock_acquire (&fat_fs->write_lock);
+	list_remove (&index->elem);
+	lock_release (&fat_fs->write_lock);
+	free (index->runs);
+	index->runs = NULL;
+	index->run_cnt = 0;
+}
+
+/* Rebuilds INDEX from the FAT. Returns false if out of memory. */
+static bool
+fat_index_build (struct fat_index *index) {
+	size_t cap = 8, cnt = 0, pos = 0;
+	struct fat_run *runs = malloc (cap * sizeof *runs);
+	cluster_t clst = index->head;
+
+	ASSERT (lock_held_by_current_thread (&fat_fs->write_lock));
+	if (runs == NULL)
+		return false;
+	while (clst != 0 && clst != EOChain) {
+		if (cnt > 0 && runs[cnt - 1].clst + runs[cnt - 1].cnt == clst)
+			runs[cnt - 1].cnt++;
+		else {
+			if (cnt == cap) {
+				struct fat_run *bigger = realloc (runs, 2 * cap * sizeof *runs);
+				if (bigger == NULL) {
+					free (runs);
+					return false;
+				}
+				runs = bigger;
+				cap *= 2;
+			}
+			runs[cnt].ofs = pos;
+			runs[cnt].clst = clst;
+			runs[cnt].cnt = 1;
+			cnt++;
+		}
+		pos++;
+		clst = fat_fs->fat[clst];
+	}
+	free (index->runs);
+	index->runs = runs;
+	index->run_cnt = cnt;
+	index->valid = true;
+	return true;
+}
+
+/* Returns cluster N, counting from 0, of INDEX's chain, or 0 if the
+ * chain is shorter than that. */
+cluster_t
+fat_index_lookup (struct fat_index *index, size_t n) {
+	size_t lo = 0, hi;
+	cluster_t clst = 0;
+
+	lock_acquire (&fat_fs->write_lock);
+	if (!index->valid && !fat_index_build (index)) {
+		/* Out of memory: walk the chain. */
+		clst = index->head;
+		while (clst != 0 && clst != EOChain && n-- > 0)
+			clst = fat_fs->fat[clst];
+		lock_release (&fat_fs->write_lock);
+		return clst == EOChain ? 0 : clst;
+	}
+
+	/* Find the last run that starts at or before N. */
+	hi = index->run_cnt;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (index->runs[mid].ofs <= n)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo > 0 && n - index->runs[lo - 1].ofs < index->runs[lo - 1].cnt)
+		clst = index->runs[lo - 1].clst + (n - index->runs[lo - 1].ofs);
+	lock_release (&fat_fs->write_lock);
+	return clst;
 }
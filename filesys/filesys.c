@@ -7,6 +7,9 @@
 #include "filesys/inode.h"
 #include "filesys/directory.h"
 #include "devices/disk.h"
+#ifdef VM
+#include "filesys/page_cache.h"
+#endif
 
 /* The disk that contains the file system. */
 struct disk *filesys_disk;
@@ -46,11 +49,15 @@ filesys_init (bool format) {
 void
 filesys_done (void) {
 	/* Original FS */
+	inode_sync ();
 #ifdef EFILESYS
 	fat_close ();
 #else
 	free_map_close ();
 #endif
+#ifdef VM
+	page_cache_flush ();
+#endif
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -8,6 +8,16 @@
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per disk sector. */
 
+/* Writes the sectors of the free map file that hold the bits of the CNT
+ * sectors from SECTOR, which just changed, rather than all of it.
+ * Returns true if successful or if the file is not open yet. */
+static bool
+free_map_write (disk_sector_t sector, size_t cnt) {
+	return free_map_file == NULL
+		|| bitmap_write_part (free_map, free_map_file, sector, cnt,
+				DISK_SECTOR_SIZE);
+}
+
 /* Initializes the free map. */
 void
 free_map_init (void) {
@@ -25,9 +35,7 @@ free_map_init (void) {
 bool
 free_map_allocate (size_t cnt, disk_sector_t *sectorp) {
 	disk_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-	if (sector != BITMAP_ERROR
-			&& free_map_file != NULL
-			&& !bitmap_write (free_map, free_map_file)) {
+	if (sector != BITMAP_ERROR && !free_map_write (sector, cnt)) {
 		bitmap_set_multiple (free_map, sector, cnt, false);
 		sector = BITMAP_ERROR;
 	}
@@ -36,12 +44,33 @@ free_map_allocate (size_t cnt, disk_sector_t *sectorp) {
 	return sector != BITMAP_ERROR;
 }
 
+/* Allocates one sector into *SECTORP, the first free one at or after
+ * HINT if there is one, so that sectors allocated one after another
+ * for a file end up adjacent.
+ * Returns true if successful, false if the disk is full. */
+bool
+free_map_allocate_near (disk_sector_t hint, disk_sector_t *sectorp) {
+	disk_sector_t sector = BITMAP_ERROR;
+
+	if (hint < bitmap_size (free_map))
+		sector = bitmap_scan_and_flip (free_map, hint, 1, false);
+	if (sector == BITMAP_ERROR)
+		sector = bitmap_scan_and_flip (free_map, 0, 1, false);
+	if (sector != BITMAP_ERROR && !free_map_write (sector, 1)) {
+		bitmap_reset (free_map, sector);
+		sector = BITMAP_ERROR;
+	}
+	if (sector != BITMAP_ERROR)
+		*sectorp = sector;
+	return sector != BITMAP_ERROR;
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (disk_sector_t sector, size_t cnt) {
 	ASSERT (bitmap_all (free_map, sector, cnt));
 	bitmap_set_multiple (free_map, sector, cnt, false);
-	bitmap_write (free_map, free_map_file);
+	free_map_write (sector, cnt);
 }
 
 /* Opens the free map file and reads it from disk. */
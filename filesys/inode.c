@@ -1,22 +1,35 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#ifdef VM
+#include "filesys/page_cache.h"
+#endif
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Sector pointers held by the on-disk inode itself, and by an index
+ * block. */
+#define DIRECT_CNT 124
+#define PTRS_PER_SECTOR (DISK_SECTOR_SIZE / sizeof (disk_sector_t))
+
 /* On-disk inode.
- * Must be exactly DISK_SECTOR_SIZE bytes long. */
+ * Must be exactly DISK_SECTOR_SIZE bytes long.
+ * The first DIRECT_CNT data sectors are in DIRECT, the next
+ * PTRS_PER_SECTOR in the index block INDIRECT, and the rest in the
+ * index blocks that the index block DOUBLY_INDIRECT points to. */
 struct inode_disk {
-	disk_sector_t start;                /* First data sector. */
 	off_t length;                       /* File size in bytes. */
 	unsigned magic;                     /* Magic number. */
-	uint32_t unused[125];               /* Not used. */
+	disk_sector_t direct[DIRECT_CNT];   /* Direct data sectors. */
+	disk_sector_t indirect;             /* Index of data sectors. */
+	disk_sector_t doubly_indirect;      /* Index of index blocks. */
 };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -28,14 +41,298 @@ bytes_to_sectors (off_t size) {
 
 /* In-memory inode. */
 struct inode {
-	struct list_elem elem;              /* Element in inode list. */
+	struct hash_elem elem;              /* Element in open_inodes. */
 	disk_sector_t sector;               /* Sector number of disk location. */
 	int open_cnt;                       /* Number of openers. */
 	bool removed;                       /* True if deleted, false otherwise. */
+	bool dirty;                         /* DATA changed since it was read. */
 	int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+	unsigned write_cnt;                 /* Writes so far, see inode_write_cnt(). */
 	struct inode_disk data;             /* Inode content. */
 };
 
+/* Cache of index blocks, so that finding a data sector past the direct
+ * ones seldom reads the disk. Dirty blocks are written back when they
+ * are replaced, by the CLOCK hand, and by inode_sync().
+ * INDEX_LOCK is held only around disk I/O, never while allocating or
+ * freeing sectors, which writes the free map file, so that eviction can
+ * look sectors up while writing back file pages. */
+#define INDEX_CACHE_SIZE 32
+static struct index_block {
+	disk_sector_t sector;
+	bool valid;
+	bool dirty;
+	bool accessed;
+	disk_sector_t ptrs[PTRS_PER_SECTOR];
+} index_cache[INDEX_CACHE_SIZE];
+static size_t index_hand;
+static struct lock index_lock;
+
+/* Returns the cached index block SECTOR, reading it in first if need
+ * be. */
+static struct index_block *
+index_get (disk_sector_t sector) {
+	struct index_block *b;
+	size_t i;
+
+	ASSERT (lock_held_by_current_thread (&index_lock));
+	for (i = 0; i < INDEX_CACHE_SIZE; i++) {
+		b = &index_cache[i];
+		if (b->valid && b->sector == sector) {
+			b->accessed = true;
+			return b;
+		}
+	}
+
+	for (;;) {
+		b = &index_cache[index_hand];
+		index_hand = (index_hand + 1) % INDEX_CACHE_SIZE;
+		if (!b->valid || !b->accessed)
+			break;
+		b->accessed = false;
+	}
+	if (b->valid && b->dirty)
+		disk_write (filesys_disk, b->sector, b->ptrs);
+	disk_read (filesys_disk, sector, b->ptrs);
+	b->sector = sector;
+	b->valid = true;
+	b->dirty = false;
+	b->accessed = true;
+	return b;
+}
+
+/* Returns the data sector N of the file D indexes. */
+static disk_sector_t
+index_lookup (const struct inode_disk *d, size_t n) {
+	disk_sector_t sector;
+
+	if (n < DIRECT_CNT)
+		return d->direct[n];
+	n -= DIRECT_CNT;
+	lock_acquire (&index_lock);
+	if (n < PTRS_PER_SECTOR)
+		sector = index_get (d->indirect)->ptrs[n];
+	else {
+		n -= PTRS_PER_SECTOR;
+		sector = index_get (d->doubly_indirect)->ptrs[n / PTRS_PER_SECTOR];
+		sector = index_get (sector)->ptrs[n % PTRS_PER_SECTOR];
+	}
+	lock_release (&index_lock);
+	return sector;
+}
+
+/* Returns how many of the first MAX pointers at PTRS, at least one, point
+ * to sectors that follow each other on the disk. */
+static size_t
+ptrs_run (const disk_sector_t *ptrs, size_t max) {
+	size_t run = 1;
+
+	while (run < max && ptrs[run] == ptrs[0] + run)
+		run++;
+	return run;
+}
+
+/* Like index_run(), but only as far as the pointers in the same block as
+ * N's go: the direct ones, or those of one index block, which is fetched
+ * once. */
+static disk_sector_t
+index_block_run (const struct inode_disk *d, size_t n, size_t max,
+		size_t *cnt) {
+	const disk_sector_t *ptrs;
+	disk_sector_t first;
+
+	if (n < DIRECT_CNT) {
+		*cnt = ptrs_run (d->direct + n,
+				max < DIRECT_CNT - n ? max : DIRECT_CNT - n);
+		return d->direct[n];
+	}
+	n -= DIRECT_CNT;
+	lock_acquire (&index_lock);
+	if (n < PTRS_PER_SECTOR)
+		ptrs = index_get (d->indirect)->ptrs;
+	else {
+		n -= PTRS_PER_SECTOR;
+		ptrs = index_get (index_get (d->doubly_indirect)
+				->ptrs[n / PTRS_PER_SECTOR])->ptrs;
+		n %= PTRS_PER_SECTOR;
+	}
+	first = ptrs[n];
+	*cnt = ptrs_run (ptrs + n,
+			max < PTRS_PER_SECTOR - n ? max : PTRS_PER_SECTOR - n);
+	lock_release (&index_lock);
+	return first;
+}
+
+/* Returns the data sector N of the file D indexes, and stores in *CNT
+ * how many of the data sectors from N on, up to MAX, follow each other
+ * on the disk, so that they can be moved with one disk command. */
+static disk_sector_t
+index_run (const struct inode_disk *d, size_t n, size_t max, size_t *cnt) {
+	size_t run, more;
+	disk_sector_t first = index_block_run (d, n, max, &run);
+
+	while (run < max && index_block_run (d, n + run, max - run, &more)
+			== first + run)
+		run += more;
+	*cnt = run;
+	return first;
+}
+
+/* Returns pointer IDX of the index block BLOCK. */
+static disk_sector_t
+index_ptr (disk_sector_t block, size_t idx) {
+	disk_sector_t sector;
+
+	lock_acquire (&index_lock);
+	sector = index_get (block)->ptrs[idx];
+	lock_release (&index_lock);
+	return sector;
+}
+
+/* Stores SECTOR as pointer IDX of the index block BLOCK. */
+static void
+index_set (disk_sector_t block, size_t idx, disk_sector_t sector) {
+	struct index_block *b;
+
+	lock_acquire (&index_lock);
+	b = index_get (block);
+	b->ptrs[idx] = sector;
+	b->dirty = true;
+	lock_release (&index_lock);
+}
+
+/* Forgets the cached copy of index block SECTOR, which is being freed. */
+static void
+index_forget (disk_sector_t sector) {
+	lock_acquire (&index_lock);
+	for (size_t i = 0; i < INDEX_CACHE_SIZE; i++)
+		if (index_cache[i].valid && index_cache[i].sector == sector)
+			index_cache[i].valid = false;
+	lock_release (&index_lock);
+}
+
+/* Writes back the dirty index blocks. */
+static void
+index_flush (void) {
+	lock_acquire (&index_lock);
+	for (size_t i = 0; i < INDEX_CACHE_SIZE; i++) {
+		struct index_block *b = &index_cache[i];
+		if (b->valid && b->dirty) {
+			disk_write (filesys_disk, b->sector, b->ptrs);
+			b->dirty = false;
+		}
+	}
+	lock_release (&index_lock);
+}
+
+/* Allocates a sector, zeroed, into *SECTORP: the first free one at or
+ * after HINT, or anywhere on the disk. */
+static bool
+sector_alloc (disk_sector_t hint, disk_sector_t *sectorp) {
+	static char zeros[DISK_SECTOR_SIZE];
+
+	if (!free_map_allocate_near (hint, sectorp))
+		return false;
+	disk_write (filesys_disk, *sectorp, zeros);
+	return true;
+}
+
+/* Allocates data sector N of the file D indexes, and the index blocks
+ * it needs. Sectors are allocated in order, so an index block is new
+ * exactly when N is the first sector it indexes. A data sector goes
+ * right after the one before it if that is free, so that appends make
+ * long runs for index_run(); index blocks go elsewhere, to the first
+ * free sector. */
+static bool
+index_extend (struct inode_disk *d, size_t n) {
+	disk_sector_t hint = n > 0 ? index_lookup (d, n - 1) + 1 : 0;
+	disk_sector_t sector, block;
+
+	if (n < DIRECT_CNT)
+		return sector_alloc (hint, &d->direct[n]);
+	n -= DIRECT_CNT;
+	if (n < PTRS_PER_SECTOR) {
+		if (n == 0 && !sector_alloc (0, &d->indirect))
+			return false;
+		if (!sector_alloc (hint, &sector)) {
+			if (n == 0)
+				free_map_release (d->indirect, 1);
+			return false;
+		}
+		index_set (d->indirect, n, sector);
+		return true;
+	}
+	n -= PTRS_PER_SECTOR;
+	if (n == 0 && !sector_alloc (0, &d->doubly_indirect))
+		return false;
+	if (n % PTRS_PER_SECTOR == 0) {
+		if (!sector_alloc (0, &block)) {
+			if (n == 0)
+				free_map_release (d->doubly_indirect, 1);
+			return false;
+		}
+		index_set (d->doubly_indirect, n / PTRS_PER_SECTOR, block);
+	} else
+		block = index_ptr (d->doubly_indirect, n / PTRS_PER_SECTOR);
+	if (!sector_alloc (hint, &sector)) {
+		if (n % PTRS_PER_SECTOR == 0) {
+			index_forget (block);
+			free_map_release (block, 1);
+		}
+		if (n == 0)
+			free_map_release (d->doubly_indirect, 1);
+		return false;
+	}
+	index_set (block, n % PTRS_PER_SECTOR, sector);
+	return true;
+}
+
+/* Frees the data sectors FROM up to TO of the file D indexes, and the
+ * index blocks that index none below FROM. */
+static void
+index_release (struct inode_disk *d, size_t from, size_t to) {
+	const size_t first_doubly = DIRECT_CNT + PTRS_PER_SECTOR;
+	size_t n;
+
+	for (n = from; n < to; n++)
+		free_map_release (index_lookup (d, n), 1);
+	if (from <= DIRECT_CNT && to > DIRECT_CNT) {
+		index_forget (d->indirect);
+		free_map_release (d->indirect, 1);
+	}
+	for (n = first_doubly; n < to; n += PTRS_PER_SECTOR)
+		if (n >= from) {
+			disk_sector_t block = index_ptr (d->doubly_indirect,
+					(n - first_doubly) / PTRS_PER_SECTOR);
+			index_forget (block);
+			free_map_release (block, 1);
+		}
+	if (from <= first_doubly && to > first_doubly) {
+		index_forget (d->doubly_indirect);
+		free_map_release (d->doubly_indirect, 1);
+	}
+}
+
+/* Grows the file D indexes to LENGTH bytes, allocating its new sectors
+ * wherever there is room. Returns false, with D unchanged, if the disk
+ * is full. */
+static bool
+inode_disk_grow (struct inode_disk *d, off_t length) {
+	size_t old_cnt = bytes_to_sectors (d->length);
+	size_t cnt = bytes_to_sectors (length);
+
+	if (cnt > DIRECT_CNT + PTRS_PER_SECTOR * (PTRS_PER_SECTOR + 1))
+		return false;
+	for (size_t n = old_cnt; n < cnt; n++)
+		if (!index_extend (d, n)) {
+			index_release (d, old_cnt, n);
+			return false;
+		}
+	if (length > d->length)
+		d->length = length;
+	return true;
+}
+
 /* Returns the disk sector that contains byte offset POS within
  * INODE.
  * Returns -1 if INODE does not contain data for a byte at offset
@@ -44,19 +341,67 @@ static disk_sector_t
 byte_to_sector (const struct inode *inode, off_t pos) {
 	ASSERT (inode != NULL);
 	if (pos < inode->data.length)
-		return inode->data.start + pos / DISK_SECTOR_SIZE;
+		return index_lookup (&inode->data, pos / DISK_SECTOR_SIZE);
 	else
 		return -1;
 }
 
-/* List of open inodes, so that opening a single inode twice
+/* Returns the disk sector that contains byte offset POS within INODE,
+ * which must be in the file, and stores in *CNT how many sectors of the
+ * file from there on, up to MAX, are adjacent on disk. */
+disk_sector_t
+inode_sector_run (const struct inode *inode, off_t pos, size_t max,
+		size_t *cnt) {
+	size_t n = pos / DISK_SECTOR_SIZE;
+	size_t left = bytes_to_sectors (inode->data.length) - n;
+
+	ASSERT (pos < inode->data.length);
+	return index_run (&inode->data, n, max < left ? max : left, cnt);
+}
+
+/* Open inodes by sector, so that opening a single inode twice
  * returns the same `struct inode'. */
-static struct list open_inodes;
+static struct hash open_inodes;
+
+static uint64_t
+inode_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct inode, elem)->sector
+		< hash_entry (b, struct inode, elem)->sector;
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void) {
-	list_init (&open_inodes);
+	hash_init (&open_inodes, inode_hash, inode_less, NULL);
+	lock_init (&index_lock);
+}
+
+/* Writes INODE's on-disk inode back if it changed. The on-disk inode is
+ * kept in memory while INODE is open and is only written here, on the
+ * last close or by inode_sync(), not on every change. */
+static void
+inode_flush (struct inode *inode) {
+	if (inode->dirty && !inode->removed)
+		disk_write (filesys_disk, inode->sector, &inode->data);
+	inode->dirty = false;
+}
+
+/* Writes back the on-disk inodes of all open inodes that changed, and
+ * the index blocks. */
+void
+inode_sync (void) {
+	struct hash_iterator i;
+
+	hash_first (&i, &open_inodes);
+	while (hash_next (&i))
+		inode_flush (hash_entry (hash_cur (&i), struct inode, elem));
+	index_flush ();
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -77,18 +422,9 @@ inode_create (disk_sector_t sector, off_t length) {
 
 	disk_inode = calloc (1, sizeof *disk_inode);
 	if (disk_inode != NULL) {
-		size_t sectors = bytes_to_sectors (length);
-		disk_inode->length = length;
 		disk_inode->magic = INODE_MAGIC;
-		if (free_map_allocate (sectors, &disk_inode->start)) {
+		if (inode_disk_grow (disk_inode, length)) {
 			disk_write (filesys_disk, sector, disk_inode);
-			if (sectors > 0) {
-				static char zeros[DISK_SECTOR_SIZE];
-				size_t i;
-
-				for (i = 0; i < sectors; i++) 
-					disk_write (filesys_disk, disk_inode->start + i, zeros); 
-			}
 			success = true; 
 		} 
 		free (disk_inode);
@@ -101,18 +437,14 @@ inode_create (disk_sector_t sector, off_t length) {
  * Returns a null pointer if memory allocation fails. */
 struct inode *
 inode_open (disk_sector_t sector) {
-	struct list_elem *e;
-	struct inode *inode;
+	struct hash_elem *e;
+	struct inode *inode, key;
 
 	/* Check whether this inode is already open. */
-	for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-			e = list_next (e)) {
-		inode = list_entry (e, struct inode, elem);
-		if (inode->sector == sector) {
-			inode_reopen (inode);
-			return inode; 
-		}
-	}
+	key.sector = sector;
+	e = hash_find (&open_inodes, &key.elem);
+	if (e != NULL)
+		return inode_reopen (hash_entry (e, struct inode, elem));
 
 	/* Allocate memory. */
 	inode = malloc (sizeof *inode);
@@ -120,11 +452,13 @@ inode_open (disk_sector_t sector) {
 		return NULL;
 
 	/* Initialize. */
-	list_push_front (&open_inodes, &inode->elem);
 	inode->sector = sector;
+	hash_insert (&open_inodes, &inode->elem);
 	inode->open_cnt = 1;
 	inode->deny_write_cnt = 0;
 	inode->removed = false;
+	inode->dirty = false;
+	inode->write_cnt = 0;
 	disk_read (filesys_disk, inode->sector, &inode->data);
 	return inode;
 }
@@ -155,14 +489,20 @@ inode_close (struct inode *inode) {
 	/* Release resources if this was the last opener. */
 	if (--inode->open_cnt == 0) {
 		/* Remove from inode list and release lock. */
-		list_remove (&inode->elem);
+		hash_delete (&open_inodes, &inode->elem);
+
+#ifdef VM
+		/* Write back or, if removed, discard its cached pages. */
+		page_cache_drop (inode, inode->removed);
+#endif
 
 		/* Deallocate blocks if removed. */
 		if (inode->removed) {
 			free_map_release (inode->sector, 1);
-			free_map_release (inode->data.start,
+			index_release (&inode->data, 0,
 					bytes_to_sectors (inode->data.length)); 
 		}
+		inode_flush (inode);
 
 		free (inode); 
 	}
@@ -185,6 +525,11 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 	off_t bytes_read = 0;
 	uint8_t *bounce = NULL;
 
+#ifdef VM
+	if (page_cache_active ())
+		return page_cache_read (inode, buffer, size, offset);
+#endif
+
 	while (size > 0) {
 		/* Disk sector to read, starting byte offset within sector. */
 		disk_sector_t sector_idx = byte_to_sector (inode, offset);
@@ -201,8 +546,17 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 			break;
 
 		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Read full sector directly into caller's buffer. */
-			disk_read (filesys_disk, sector_idx, buffer + bytes_read); 
+			/* Read full sectors directly into caller's buffer, as many
+			 * adjacent ones as the request covers with one command. */
+			off_t full = (size < inode_left ? size : inode_left)
+				/ DISK_SECTOR_SIZE;
+			size_t cnt;
+
+			sector_idx = inode_sector_run (inode, offset,
+					full < DISK_MAX_SECTORS ? full : DISK_MAX_SECTORS, &cnt);
+			disk_read_multiple (filesys_disk, sector_idx, cnt,
+					buffer + bytes_read);
+			chunk_size = cnt * DISK_SECTOR_SIZE;
 		} else {
 			/* Read sector into bounce buffer, then partially copy
 			 * into caller's buffer. */
@@ -227,9 +581,8 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
  * Returns the number of bytes actually written, which may be
- * less than SIZE if end of file is reached or an error occurs.
- * (Normally a write at end of file would extend the inode, but
- * growth is not yet implemented.) */
+ * less than SIZE if the disk is full or an error occurs.
+ * A write past end of file extends the inode, with zeros in any gap. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		off_t offset) {
@@ -239,6 +592,18 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 
 	if (inode->deny_write_cnt)
 		return 0;
+	if (size > 0 && offset + size > inode->data.length
+			&& inode_disk_grow (&inode->data, offset + size))
+		inode->dirty = true;
+
+#ifdef VM
+	if (page_cache_active ()) {
+		bytes_written = page_cache_write (inode, buffer, size, offset);
+		if (bytes_written > 0)
+			inode->write_cnt++;
+		return bytes_written;
+	}
+#endif
 
 	while (size > 0) {
 		/* Sector to write, starting byte offset within sector. */
@@ -284,6 +649,8 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 	}
 	free (bounce);
 
+	if (bytes_written > 0)
+		inode->write_cnt++;
 	return bytes_written;
 }
 
@@ -306,6 +673,20 @@ inode_allow_write (struct inode *inode) {
 	inode->deny_write_cnt--;
 }
 
+/* Returns the number of writes to INODE that changed its data since it
+ * was opened. Anything derived from its contents is stale once this
+ * changes. */
+unsigned
+inode_write_cnt (const struct inode *inode) {
+	return inode->write_cnt;
+}
+
+/* Returns true if INODE has been removed. */
+bool
+inode_is_removed (const struct inode *inode) {
+	return inode->removed;
+}
+
 /* Returns the length, in bytes, of INODE's data. */
 off_t
 inode_length (const struct inode *inode) {
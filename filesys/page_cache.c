@@ -1,9 +1,45 @@
-/* page_cache.c: Implementation of Page Cache (Buffer Cache). */
+/* page_cache.c: Implementation of Page Cache (Buffer Cache).
+ *
+ * File data is cached a page at a time in frames of the user pool, so it
+ * competes for memory with user pages and leaves it the same way, through
+ * the swap_out hook of its struct page. Each cached page of a file is a
+ * struct page of type VM_PAGE_CACHE that belongs to no process. It stays
+ * in CACHE, keyed by inode and page number, while its frame comes and
+ * goes, until the file's last close. Writes only mark it dirty; eviction,
+ * page_cache_kworkerd every FLUSH_INTERVAL, and the last close write it
+ * back.
+ *
+ * CACHE_LOCK is taken before the frame lock, and is never held while a
+ * frame is taken, since eviction may write dirty mappings through the
+ * cache. The frame of a page is pinned under CACHE_LOCK while it is copied
+ * from or to, and the copy is made with CACHE_LOCK released, since
+ * faulting in a user buffer may read a file. Disk reads are made with
+ * CACHE_LOCK released too, so that a miss does not hold up all other
+ * file I/O; a page being read in is marked loading, and lookups wait on
+ * LOAD_COND until it is in. Frames of the cache are charged to no
+ * process, so they are taken regardless of the caller's resident set
+ * limit. */
 
+#include "filesys/page_cache.h"
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/disk.h"
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 #include "vm/vm.h"
+
+#ifdef VM
 static bool page_cache_readahead (struct page *page, void *kva);
 static bool page_cache_writeback (struct page *page);
 static void page_cache_destroy (struct page *page);
+static void page_cache_kworkerd (void *aux);
 
 /* DO NOT MODIFY this struct */
 static const struct page_operations page_cache_op = {
@@ -15,36 +51,440 @@ static const struct page_operations page_cache_op = {
 
 tid_t page_cache_workerd;
 
+/* Pages read ahead after a miss. */
+#define READAHEAD_PAGES 4
+
+/* Ticks between write backs of dirty pages by page_cache_kworkerd. */
+#define FLUSH_INTERVAL TIMER_FREQ
+
+static struct hash cache;
+static struct lock cache_lock;
+static struct condition load_cond;  /* Signaled when a page is read in. */
+static bool cache_active;
+
+/* Scratch page for writes that miss while evicting, see
+ * page_cache_write_through(). Protected by CACHE_LOCK. */
+static uint8_t *evict_bounce;
+
+/* Statistics. */
+static long long hit_cnt;         /* Lookups that found the page resident. */
+static long long miss_cnt;        /* Lookups that read it in. */
+static long long readahead_cnt;   /* Pages read ahead. */
+static long long writeback_cnt;   /* Pages written back. */
+
+static uint64_t
+cache_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct page_cache *pc = hash_entry (e, struct page_cache, elem);
+	return hash_bytes (&pc->inode, sizeof pc->inode) ^ hash_int (pc->index);
+}
+
+static bool
+cache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct page_cache *a = hash_entry (a_, struct page_cache, elem);
+	const struct page_cache *b = hash_entry (b_, struct page_cache, elem);
+	if (a->inode != b->inode)
+		return a->inode < b->inode;
+	return a->index < b->index;
+}
+
 /* The initializer of file vm */
 void
 pagecache_init (void) {
 	/* TODO: Create a worker daemon for page cache with page_cache_kworkerd */
+	hash_init (&cache, cache_hash, cache_less, NULL);
+	lock_init (&cache_lock);
+	cond_init (&load_cond);
+	evict_bounce = palloc_get_page (PAL_ASSERT);
+	page_cache_workerd = thread_create ("kworkerd", PRI_DEFAULT,
+			page_cache_kworkerd, NULL);
+	cache_active = true;
+}
+
+/* Returns true once file data goes through the cache. */
+bool
+page_cache_active (void) {
+	return cache_active;
 }
 
 /* Initialize the page cache */
 bool
-page_cache_initializer (struct page *page, enum vm_type type, void *kva) {
+page_cache_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva UNUSED) {
 	/* Set up the handler */
 	page->operations = &page_cache_op;
+	return true;
+}
+
+/* Reads, or writes if WRITE, the part of page INDEX of INODE that lies
+ * within the file from or to KVA, with one disk command per run of
+ * adjacent sectors. A read zeroes the rest of the page. */
+static void
+page_cache_io (struct inode *inode, size_t index, uint8_t *kva, bool write) {
+	off_t pos = (off_t) index * PGSIZE;
+	off_t left = inode_length (inode) - pos;
+	size_t cnt = left <= 0 ? 0
+		: DIV_ROUND_UP (left < PGSIZE ? left : PGSIZE, DISK_SECTOR_SIZE);
+	size_t i, run;
+
+	for (i = 0; i < cnt; i += run) {
+		disk_sector_t first = inode_sector_run (inode,
+				pos + i * DISK_SECTOR_SIZE, cnt - i, &run);
+
+		if (write)
+			disk_write_multiple (filesys_disk, first, run,
+					kva + i * DISK_SECTOR_SIZE);
+		else
+			disk_read_multiple (filesys_disk, first, run,
+					kva + i * DISK_SECTOR_SIZE);
+	}
+	if (!write)
+		memset (kva + cnt * DISK_SECTOR_SIZE, 0,
+				PGSIZE - cnt * DISK_SECTOR_SIZE);
+}
+
+/* Returns the cached page INDEX of INODE. If there is none, makes one if
+ * CREATE, or else returns NULL. */
+static struct page *
+page_cache_lookup (struct inode *inode, size_t index, bool create) {
+	struct page_cache key;
+	struct hash_elem *e;
+	struct page *page;
+
+	ASSERT (lock_held_by_current_thread (&cache_lock));
+	key.inode = inode;
+	key.index = index;
+	e = hash_find (&cache, &key.elem);
+	if (e != NULL)
+		return hash_entry (e, struct page, page_cache.elem);
+	if (!create)
+		return NULL;
+
+	page = malloc (sizeof *page);
+	if (page == NULL)
+		return NULL;
+	page_cache_initializer (page, VM_PAGE_CACHE, NULL);
+	page->va = NULL;
+	page->frame = NULL;
+	page->owner = NULL;
+	page->writable = true;
+	page->is_stack = page->is_text = page->is_mmap = false;
+	page->page_cache.inode = inode;
+	page->page_cache.index = index;
+	page->page_cache.dirty = false;
+	page->page_cache.accessed = false;
+	page->page_cache.loading = false;
+	hash_insert (&cache, &page->page_cache.elem);
+	return page;
+}
+
+/* Reads PAGE, which has no frame, into FRAME, which the caller took, with
+ * CACHE_LOCK released meanwhile, and makes FRAME PAGE's. The read goes
+ * through swap_in(), which reads ahead, unless PAGE is itself being read
+ * ahead (AHEAD). */
+static void
+page_cache_load (struct page *page, struct frame *frame, bool ahead) {
+	ASSERT (lock_held_by_current_thread (&cache_lock));
+	ASSERT (page->frame == NULL && !page->page_cache.loading);
+	page->page_cache.loading = true;
+	lock_release (&cache_lock);
+	if (ahead)
+		page_cache_io (page->page_cache.inode, page->page_cache.index,
+				frame->kva, false);
+	else
+		swap_in (page, frame->kva);
+	lock_acquire (&cache_lock);
+	vm_frame_link (frame, page);
+	page->page_cache.loading = false;
+	cond_broadcast (&load_cond, &cache_lock);
+}
+
+/* Returns the frame cached page INDEX of INODE is in, pinned with
+ * vm_frame_pin(), reading it in first if need be, and sets *PAGEP to the
+ * page. Returns NULL if memory is short. CACHE_LOCK is let go while a
+ * frame is taken or the page read, and the page looked up again after. */
+static struct frame *
+page_cache_pin (struct inode *inode, size_t index, struct page **pagep) {
+	struct frame *frame = NULL, *spare = NULL;
+	struct page *page;
+
+	ASSERT (lock_held_by_current_thread (&cache_lock));
+	while ((page = page_cache_lookup (inode, index, true)) != NULL) {
+		if (page->page_cache.loading) {
+			cond_wait (&load_cond, &cache_lock);
+			continue;
+		}
+		frame = vm_frame_pin (page);
+		if (frame != NULL) {
+			hit_cnt++;
+			break;
+		}
+		if (spare != NULL) {
+			frame = spare;
+			spare = NULL;
+			frame->pin_cnt++;
+			page_cache_load (page, frame, false);
+			frame->pinned = false;
+			miss_cnt++;
+			break;
+		}
+		lock_release (&cache_lock);
+		spare = vm_get_unowned_frame ();
+		lock_acquire (&cache_lock);
+	}
+	if (spare != NULL)
+		vm_free_frame (spare);
+	if (page != NULL)
+		page->page_cache.accessed = true;
+	*pagep = page;
+	return frame;
+}
+
+/* Returns the bytes of SIZE at OFFSET in INODE that lie in one page and
+ * within the file. */
+static int
+page_cache_chunk (struct inode *inode, off_t size, off_t offset) {
+	off_t inode_left = inode_length (inode) - offset;
+	int page_left = PGSIZE - offset % PGSIZE;
+	int min_left = inode_left < page_left ? inode_left : page_left;
+	return size < min_left ? size : min_left;
+}
+
+/* Reads SIZE bytes at OFFSET in INODE into BUFFER through the cache.
+ * Returns the number of bytes read. */
+off_t
+page_cache_read (struct inode *inode, void *buffer_, off_t size,
+		off_t offset) {
+	uint8_t *buffer = buffer_;
+	off_t bytes_read = 0;
 
+	ASSERT (!vm_evicting ());
+	while (size > 0) {
+		int chunk_size = page_cache_chunk (inode, size, offset);
+		struct page *page;
+		struct frame *frame;
+
+		if (chunk_size <= 0)
+			break;
+		lock_acquire (&cache_lock);
+		frame = page_cache_pin (inode, offset / PGSIZE, &page);
+		lock_release (&cache_lock);
+		if (frame == NULL)
+			break;
+		memcpy (buffer + bytes_read, (uint8_t *) frame->kva + offset % PGSIZE,
+				chunk_size);
+		vm_frame_unpin (frame);
+
+		size -= chunk_size;
+		offset += chunk_size;
+		bytes_read += chunk_size;
+	}
+	return bytes_read;
 }
 
-/* Utilze the Swap in mechanism to implement readhead */
+/* Writes for eviction, which writes back dirty mmap pages: CACHE_LOCK
+ * and frames being evicted, maybe in the same batch, can not be waited for
+ * then, and no frame can be taken. A resident page is written, anything
+ * else goes straight to disk. Stops short if CACHE_LOCK or a page is busy,
+ * so that the mmap page stays resident. */
+static off_t
+page_cache_write_through (struct inode *inode, const uint8_t *buffer,
+		off_t size, off_t offset) {
+	off_t bytes_written = 0;
+
+	if (!lock_try_acquire (&cache_lock))
+		return 0;
+	while (size > 0) {
+		int chunk_size = page_cache_chunk (inode, size, offset);
+		size_t index = offset / PGSIZE;
+		struct page *page;
+		struct frame *frame = NULL;
+
+		if (chunk_size <= 0)
+			break;
+		page = page_cache_lookup (inode, index, false);
+		if (page != NULL && (page->page_cache.loading
+					|| !vm_frame_try_pin (page, &frame)))
+			break;
+		if (frame != NULL) {
+			memcpy ((uint8_t *) frame->kva + offset % PGSIZE,
+					buffer + bytes_written, chunk_size);
+			page->page_cache.dirty = true;
+			vm_frame_unpin (frame);
+		} else {
+			if (chunk_size < PGSIZE)
+				page_cache_io (inode, index, evict_bounce, false);
+			memcpy (evict_bounce + offset % PGSIZE, buffer + bytes_written,
+					chunk_size);
+			page_cache_io (inode, index, evict_bounce, true);
+		}
+
+		size -= chunk_size;
+		offset += chunk_size;
+		bytes_written += chunk_size;
+	}
+	lock_release (&cache_lock);
+	return bytes_written;
+}
+
+/* Writes SIZE bytes from BUFFER at OFFSET in INODE through the cache.
+ * Returns the number of bytes written. */
+off_t
+page_cache_write (struct inode *inode, const void *buffer_, off_t size,
+		off_t offset) {
+	const uint8_t *buffer = buffer_;
+	off_t bytes_written = 0;
+
+	if (vm_evicting ())
+		return page_cache_write_through (inode, buffer, size, offset);
+
+	while (size > 0) {
+		int chunk_size = page_cache_chunk (inode, size, offset);
+		struct page *page;
+		struct frame *frame;
+
+		if (chunk_size <= 0)
+			break;
+		lock_acquire (&cache_lock);
+		frame = page_cache_pin (inode, offset / PGSIZE, &page);
+		lock_release (&cache_lock);
+		if (frame == NULL)
+			break;
+		memcpy ((uint8_t *) frame->kva + offset % PGSIZE,
+				buffer + bytes_written, chunk_size);
+		/* Only after the copy, or a flush in between would clear it. */
+		lock_acquire (&cache_lock);
+		page->page_cache.dirty = true;
+		lock_release (&cache_lock);
+		vm_frame_unpin (frame);
+
+		size -= chunk_size;
+		offset += chunk_size;
+		bytes_written += chunk_size;
+	}
+	return bytes_written;
+}
+
+/* Utilze the Swap in mechanism to implement readhead. Called by
+ * page_cache_load() without CACHE_LOCK, which is taken only to find and
+ * link each page read ahead, not across the reads. */
 static bool
 page_cache_readahead (struct page *page, void *kva) {
+	struct page_cache *pc = &page->page_cache;
+	size_t end = DIV_ROUND_UP (inode_length (pc->inode), PGSIZE);
+
+	page_cache_io (pc->inode, pc->index, kva, false);
+
+	/* Only into free frames, and up to the first page already cached. */
+	for (size_t i = pc->index + 1; i < end && i <= pc->index + READAHEAD_PAGES;
+			i++) {
+		struct page *next;
+		struct frame *frame;
+
+		lock_acquire (&cache_lock);
+		next = page_cache_lookup (pc->inode, i, true);
+		if (next == NULL || next->frame != NULL || next->page_cache.loading
+				|| (frame = vm_try_get_unowned_frame ()) == NULL) {
+			lock_release (&cache_lock);
+			break;
+		}
+		page_cache_load (next, frame, true);
+		frame->pinned = false;
+		readahead_cnt++;
+		lock_release (&cache_lock);
+	}
+	return true;
 }
 
 /* Utilze the Swap out mechanism to implement writeback */
 static bool
 page_cache_writeback (struct page *page) {
+	struct page_cache *pc = &page->page_cache;
+
+	if (pc->dirty) {
+		page_cache_io (pc->inode, pc->index, page->frame->kva, true);
+		pc->dirty = false;
+		writeback_cnt++;
+	}
+	return true;
 }
 
 /* Destory the page_cache. */
 static void
 page_cache_destroy (struct page *page) {
+	vm_release_frame (page);
+}
+
+/* Writes PAGE back if it is dirty. */
+static void
+page_cache_flush_page (struct page *page) {
+	struct frame *frame;
+
+	ASSERT (lock_held_by_current_thread (&cache_lock));
+	if (!page->page_cache.dirty || (frame = vm_frame_pin (page)) == NULL)
+		return;
+	page_cache_io (page->page_cache.inode, page->page_cache.index, frame->kva,
+			true);
+	page->page_cache.dirty = false;
+	writeback_cnt++;
+	vm_frame_unpin (frame);
+}
+
+/* Writes back every dirty page. */
+void
+page_cache_flush (void) {
+	struct hash_iterator i;
+
+	if (!cache_active)
+		return;
+	lock_acquire (&cache_lock);
+	hash_first (&i, &cache);
+	while (hash_next (&i))
+		page_cache_flush_page (hash_entry (hash_cur (&i), struct page,
+					page_cache.elem));
+	lock_release (&cache_lock);
+}
+
+/* Drops the cached pages of INODE, which is being closed for the last
+ * time, writing them back first unless DISCARD. */
+void
+page_cache_drop (struct inode *inode, bool discard) {
+	size_t cnt = DIV_ROUND_UP (inode_length (inode), PGSIZE);
+
+	if (!cache_active)
+		return;
+	lock_acquire (&cache_lock);
+	for (size_t i = 0; i < cnt; i++) {
+		struct page *page = page_cache_lookup (inode, i, false);
+
+		if (page == NULL)
+			continue;
+		if (discard)
+			page->page_cache.dirty = false;
+		else
+			page_cache_flush_page (page);
+		hash_delete (&cache, &page->page_cache.elem);
+		vm_dealloc_page (page);
+	}
+	lock_release (&cache_lock);
+}
+
+/* Prints page cache statistics. */
+void
+page_cache_print_stats (void) {
+	if (!cache_active)
+		return;
+	printf ("Page cache: %lld hits, %lld misses, %lld read ahead, "
+			"%lld written back\n", hit_cnt, miss_cnt, readahead_cnt,
+			writeback_cnt);
 }
 
 /* Worker thread for page cache */
 static void
-page_cache_kworkerd (void *aux) {
+page_cache_kworkerd (void *aux UNUSED) {
+	for (;;) {
+		timer_sleep (FLUSH_INTERVAL);
+		page_cache_flush ();
+	}
 }
+#endif /* VM */
@@ -4,6 +4,7 @@
 #include "devices/disk.h"
 #include "filesys/file.h"
 #include <inttypes.h>
+#include <list.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -35,4 +36,24 @@ cluster_t fat_get (cluster_t clst);
 void fat_put (cluster_t clst, cluster_t val);
 disk_sector_t cluster_to_sector (cluster_t clst);
 
+/* A run of consecutive clusters in a chain. */
+struct fat_run {
+	size_t ofs;             /* Position of CLST in the chain. */
+	cluster_t clst;         /* First cluster. */
+	size_t cnt;             /* Number of clusters. */
+};
+
+/* Index of a chain, see fat.c. */
+struct fat_index {
+	struct list_elem elem;  /* In the FAT's list of indexes. */
+	cluster_t head;         /* First cluster of the chain. */
+	struct fat_run *runs;   /* Runs in chain order. */
+	size_t run_cnt;
+	bool valid;             /* False once the chain changed. */
+};
+
+void fat_index_init (struct fat_index *index, cluster_t head);
+void fat_index_destroy (struct fat_index *index);
+cluster_t fat_index_lookup (struct fat_index *index, size_t n);
+
 #endif /* filesys/fat.h */
@@ -2,6 +2,7 @@
 #define FILESYS_INODE_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "filesys/off_t.h"
 #include "devices/disk.h"
 
@@ -14,10 +15,15 @@ struct inode *inode_reopen (struct inode *);
 disk_sector_t inode_get_inumber (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
+void inode_sync (void);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
+unsigned inode_write_cnt (const struct inode *);
+bool inode_is_removed (const struct inode *);
 off_t inode_length (const struct inode *);
+disk_sector_t inode_sector_run (const struct inode *, off_t pos, size_t max,
+		size_t *cnt);
 
 #endif /* filesys/inode.h */
@@ -1,12 +1,32 @@
 #ifndef FILESYS_PAGE_CACHE_H
 #define FILESYS_PAGE_CACHE_H
-#include "vm/vm.h"
+#include <hash.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
 
 struct page;
+struct inode;
 enum vm_type;
 
-struct page_cache {};
+/* A page of a file in the page cache, see page_cache.c. */
+struct page_cache {
+	struct inode *inode;
+	size_t index;               /* Page number within the file. */
+	struct hash_elem elem;      /* In the cache. */
+	bool dirty;                 /* Written since it was last written back. */
+	bool accessed;              /* Used since the CLOCK hand last passed. */
+	bool loading;               /* Being read in, without a frame yet. */
+};
 
-void page_cache_init (void);
+void pagecache_init (void);
 bool page_cache_initializer (struct page *page, enum vm_type type, void *kva);
+bool page_cache_active (void);
+off_t page_cache_read (struct inode *inode, void *buffer, off_t size,
+		off_t offset);
+off_t page_cache_write (struct inode *inode, const void *buffer, off_t size,
+		off_t offset);
+void page_cache_drop (struct inode *inode, bool discard);
+void page_cache_flush (void);
+void page_cache_print_stats (void);
 #endif
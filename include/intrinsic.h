@@ -31,6 +31,13 @@ static __inline void lidt(const struct desc_ptr *dtr) {
 	__asm __volatile("lidt %0" : : "m" (*dtr));
 }
 
+__attribute__((always_inline))
+static __inline uint64_t rdtsc(void) {
+	uint32_t lo, hi;
+	__asm __volatile("rdtsc" : "=a" (lo), "=d" (hi));
+	return (uint64_t) hi << 32 | lo;
+}
+
 __attribute__((always_inline))
 static __inline void invlpg(uint64_t addr) {
 	__asm __volatile("invlpg (%0)" : : "r" (addr) : "memory");
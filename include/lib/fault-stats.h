@@ -0,0 +1,31 @@
+#ifndef __LIB_FAULT_STATS_H
+#define __LIB_FAULT_STATS_H
+
+#include <stdint.h>
+
+/* What a page fault did. */
+enum fault_type {
+	FT_LOAD,        /* First touch, loaded from file or zeroed */
+	FT_ZERO,        /* Read of untouched anonymous page, zero frame mapped */
+	FT_SWAP,        /* Brought back from swap or from its file */
+	FT_STAGED,      /* Already read in by swap readahead */
+	FT_WP,          /* Write to a copy-on-write page */
+	FT_STACK,       /* Stack growth */
+	FT_EVICT,       /* Not a fault: a page was evicted to get a frame */
+	FT_CNT
+};
+
+/* Latency histogram buckets. Bucket I counts the events that took from
+ * 2**I up to 2**(I+1) - 1 TSC cycles. */
+#define FAULT_HIST_BUCKETS 40
+
+/* Page fault counters, as filled in by the fault_stats() system call. */
+struct fault_stats {
+	uint64_t cnt[FT_CNT];           /* Events of each type. */
+	uint64_t cycles[FT_CNT];        /* TSC cycles they took in all. */
+	uint64_t hist[FT_CNT][FAULT_HIST_BUCKETS];  /* System-wide only. */
+	uint64_t swap_ra_hit;           /* Swap readahead pages later used. */
+	uint64_t swap_ra_miss;          /* Ones dropped unused. */
+};
+
+#endif /* lib/fault-stats.h */
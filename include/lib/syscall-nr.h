@@ -22,6 +22,10 @@ enum {
 	/* Project 3 and optionally project 4. */
 	SYS_MMAP,                   /* Map a file into memory. */
 	SYS_MUNMAP,                 /* Remove a memory mapping. */
+	SYS_MSYNC,                  /* Write back a memory mapping. */
+	SYS_MADVISE,                /* Advise how memory will be used. */
+	SYS_SET_RSS_LIMIT,          /* Limit the frames a process holds. */
+	SYS_FAULT_STATS,            /* Read page fault counters. */
 
 	/* Project 4 only. */
 	SYS_CHDIR,                  /* Change the current directory. */
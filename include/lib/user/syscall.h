@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <debug.h>
 #include <stddef.h>
+#include <fault-stats.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -13,6 +14,13 @@ typedef int pid_t;
 typedef int off_t;
 #define MAP_FAILED ((void *) NULL)
 
+/* Advice for madvise(). */
+#define MADV_NORMAL 0           /* Default readahead. */
+#define MADV_RANDOM 1           /* Expect random access, no readahead. */
+#define MADV_SEQUENTIAL 2       /* Expect sequential access. */
+#define MADV_WILLNEED 3         /* Load the range now. */
+#define MADV_DONTNEED 4         /* Drop the range now. */
+
 /* Maximum characters in a filename written by readdir(). */
 #define READDIR_MAX_LEN 14
 
@@ -41,6 +49,10 @@ int dup2(int oldfd, int newfd);
 /* Project 3 and optionally project 4. */
 void *mmap (void *addr, size_t length, int writable, int fd, off_t offset);
 void munmap (void *addr);
+int msync (void *addr, size_t length);
+int madvise (void *addr, size_t length, int advice);
+size_t set_rss_limit (size_t pages);
+int fault_stats (struct fault_stats *st, bool all);
 
 /* Project 4 only. */
 bool chdir (const char *dir);
@@ -41,5 +41,11 @@
 #define PTE_U 0x4                        /* 1=user/kernel, 0=kernel only. */
 #define PTE_A 0x20                       /* 1=accessed, 0=not acccessed. */
 #define PTE_D 0x40                       /* 1=dirty, 0=not dirty (PTEs only). */
+#define PTE_PS 0x80                      /* 1=2 MiB page (PDEs only). */
+
+/* A large page, mapped by one PDE with PTE_PS set. */
+#define LGPGSIZE (1UL << PDXSHIFT)
+#define LGPG_PAGES (LGPGSIZE / PGSIZE)
+#define lg_round_down(va) ((void *) ((uint64_t) (va) & ~(LGPGSIZE - 1)))
 
 #endif /* threads/pte.h */
@@ -7,6 +7,7 @@
 #include "threads/interrupt.h"
 #ifdef VM
 #include "vm/vm.h"
+#include "vm/trace.h"
 #endif
 
 /* States in a thread's life cycle. */
@@ -100,7 +101,6 @@ struct thread {
 	struct semaphore* wait_sema;	
 	struct semaphore* fork_sema;	
 	struct list opfile_list;
-	struct list mmfile_list;	
 	bool stdin;
 	bool stdout;
 	// bool dup2;
@@ -116,7 +116,13 @@ struct thread {
 #ifdef VM
 	/* Table for whole virtual memory owned by thread. */
 	struct supplemental_page_table spt;
-	int pnum_count;
+	int pnum_count;                     /* Frames charged to it. */
+	size_t rss_limit;                   /* At most that many, 0: no limit. */
+	int swap_ra_hit;                    /* Readahead pages later used. */
+	int swap_ra_miss;                   /* Readahead pages dropped unused. */
+	bool evicting;                      /* Writing out frames it evicts. */
+	uint32_t fault_cnt[FT_CNT];         /* Faults by type, see trace.c. */
+	uint64_t fault_cycles[FT_CNT];      /* TSC cycles they took. */
 #endif
 
 	struct thread* parent;
@@ -149,19 +155,6 @@ struct open_file {
 	struct list_elem elem;
 };
 
-struct mm_file {
-	void * addr;
-	struct list page_list;
-	struct list_elem elem;
-};
-
-struct page_addr{
-	void * addr;
-	struct file* file; 
-	off_t offset;
-	size_t size;
-	struct list_elem elem;
-};
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
    Controlled by kernel command-line option "-o mlfqs". */
@@ -9,4 +9,6 @@ int process_exec (void *f_name);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (struct thread *next);
+void exec_cache_init (void);
+void exec_cache_done (void);
 #endif /* userprog/process.h */
@@ -1,14 +1,37 @@
 #ifndef VM_ANON_H
 #define VM_ANON_H
+#include <stddef.h>
+#include <stdint.h>
 #include "vm/vm.h"
 struct page;
 enum vm_type;
 
+/* Most anonymous pages written to swap with one disk transfer. */
+#define SWAP_CLUSTER 8
+
+struct zswap_entry;
+
 struct anon_page {
     int disk_n;
+    bool staged;        /* Frame filled by readahead, not yet mapped */
+    struct zswap_entry *zswap;  /* Compressed copy, see zswap.c */
 };
 
+extern size_t swap_readahead_window;
+
 void vm_anon_init (void);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
+void anon_fork_page (struct page *child);
+bool anon_needs_writeback (struct page *page);
+bool anon_swap_out_cluster (struct page **pages, size_t cnt);
+void anon_share_swapped (struct page *page, struct page *from);
+bool anon_claim_staged (struct page *page);
+size_t swap_slot_alloc (size_t cnt);
+void swap_slot_free (size_t slot);
+void swap_slot_dup (size_t slot);
+void swap_slot_set_page (size_t slot, struct page *page);
+void swap_write_slot (size_t slot, const void *kva);
+void swap_ra_stats (uint64_t *hit, uint64_t *miss);
+void swap_print_stats (void);
 
 #endif
@@ -2,17 +2,44 @@
 #define VM_FILE_H
 #include "filesys/file.h"
 #include "vm/vm.h"
+#include "vm/uninit.h"
 
 struct page;
+struct vma;
+struct supplemental_page_table;
 enum vm_type;
 
 struct file_page {
 	void *aux;
 };
 
+/* Where the contents of a lazily loaded page of an mmap or of an
+ * executable segment come from. */
+struct lazyload {
+	struct file *file;
+	uint8_t *upage;
+	uint32_t read_bytes;
+	uint32_t zero_bytes;
+	off_t offset;
+	bool writable;
+};
+
+/* Largest fault-around window, in pages. */
+#define FAULT_AROUND_MAX 16
+
+extern size_t fault_around_window;
+
 void vm_file_init (void);
 bool file_backed_initializer (struct page *page, enum vm_type type, void *kva);
 void *do_mmap(void *addr, size_t length, int writable,
 		struct file *file, off_t offset);
 void do_munmap (void *va);
+void do_munmap_all (void);
+bool do_msync (void *addr, size_t length);
+bool file_map_text (struct page *page);
+bool file_share_text (struct page *page);
+void file_map_text_area (struct supplemental_page_table *spt,
+		struct vma *vma);
+bool lazyload_around (struct page *page, struct lazyload *aux,
+		vm_initializer *init);
 #endif
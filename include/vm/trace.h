@@ -0,0 +1,33 @@
+#ifndef VM_TRACE_H
+#define VM_TRACE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <fault-stats.h>
+
+/* One record of the trace, as written to FAULT_TRACE_FILE after a
+ * header of "FTRC", the record count and the count of records lost to
+ * wrapping, each 32-bit little-endian. */
+struct fault_rec {
+	uint64_t va;          /* Page */
+	uint32_t tick;        /* timer_ticks() */
+	uint16_t tid;         /* Faulting (or evicted page's) thread */
+	uint8_t write;        /* 1 for a write fault */
+	uint8_t type;         /* enum fault_type */
+};
+
+/* File the trace is saved to after each `run' action. */
+#define FAULT_TRACE_FILE "fault.trace"
+
+extern size_t fault_trace_size;
+
+void fault_trace_init (void);
+void fault_trace_add (const void *va, int tid, bool write,
+		enum fault_type type);
+void fault_trace_save (void);
+
+void fault_stat_add (enum fault_type type, uint64_t cycles);
+void fault_stat_get (struct fault_stats *st, bool all);
+void fault_stat_print (void);
+
+#endif
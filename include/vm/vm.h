@@ -2,6 +2,7 @@
 #define VM_VM_H
 #include <stdbool.h>
 #include <hash.h>
+#include <list.h>
 #include "threads/palloc.h"
 
 enum vm_type {
@@ -28,9 +29,11 @@ enum vm_type {
 #include "vm/uninit.h"
 #include "vm/anon.h"
 #include "vm/file.h"
+#include "filesys/page_cache.h"
 
 struct page_operations;
 struct thread;
+struct inode;
 
 #define VM_TYPE(type) ((type) & 7)
 
@@ -45,27 +48,44 @@ struct page {
 
 	/* Your implementation */
 	struct hash_elem elem;
+	struct list_elem frame_elem;  /* In FRAME's list of pages */
+	struct thread *owner;  /* Thread whose spt and pml4 hold this page */
 	bool claimed;
-	int evict_cnt;
 	bool writable;
 	bool is_stack;
+	bool is_text;          /* Read-only executable page, shared (see file.c) */
+	bool is_mmap;          /* Page of a mapping, shared the same way */
 	/* Per-type data are binded into the union.
 	 * Each function automatically detects the current union */
 	union {
 		struct uninit_page uninit;
 		struct anon_page anon;
 		struct file_page file;
-#ifdef EFILESYS
 		struct page_cache page_cache;
-#endif
 	};
 };
 
-/* The representation of "frame" */
+/* The representation of "frame".
+ * There is exactly one of these for every page of the user pool, kept in a
+ * table indexed by physical frame number (see vm_frame_table_init). */
 struct frame {
 	void *kva;
-	int shared;
-	struct page *page;
+	int shared;            /* Number of pages mapping this frame */
+	struct page *page;     /* Page to evict through, NULL if none */
+	struct list pages;     /* Pages mapping this frame */
+	bool pinned;           /* Do not evict while being filled or copied */
+	int pin_cnt;           /* Pinned by this many vm_frame_pin() calls */
+	bool evicting;         /* Being written out, see vm_evict_frame() */
+	bool dirty;            /* Written through a page that since let go */
+	bool merged;           /* Shared by the merge thread, not by fork */
+
+	/* Set while the frame holds shared text or a page of shared mappings,
+	 * see vm_text_get(). */
+	struct inode *text_inode;
+	off_t text_ofs;
+	uint32_t text_len;
+	bool text_mmap;        /* Mapping page, not text */
+	struct hash_elem text_elem;
 };
 
 /* The function table for page operations.
@@ -90,12 +110,35 @@ struct page_operations {
 struct supplemental_page_table {
 	struct hash *hash_table;
 	void* stack_bottom;
-	struct list list_vic;
+	struct list vma_list;  /* Mapped areas, sorted by address */
 };
 
-struct vic_elem {
-	void* va;
-	struct list_elem elem; 
+/* Access pattern a process declared for an area with madvise(). Values
+ * match MADV_* in lib/user/syscall.h. */
+enum vm_advice {
+	ADV_NORMAL,            /* Default fault-around and readahead */
+	ADV_RANDOM,            /* No fault-around or readahead */
+	ADV_SEQUENTIAL,        /* Most fault-around, pages behind go first */
+	ADV_WILLNEED,          /* Load the range now */
+	ADV_DONTNEED,          /* Drop the range now */
+};
+
+/* A mapped area of the address space: an executable segment or an mmap.
+ * Its pages get a struct page only when first touched, see
+ * vma_get_page(). */
+struct vma {
+	struct list_elem elem;
+	void *start;           /* First page */
+	void *end;             /* Just past the last page */
+	enum vm_type type;     /* VM_ANON or VM_FILE */
+	vm_initializer *init;  /* Loads a page from FILE */
+	struct file *file;
+	off_t offset;          /* File offset of START */
+	size_t read_bytes;     /* Bytes of FILE mapped from START; zeroes after */
+	bool writable;
+	bool is_text;          /* Pages are shared text */
+	bool is_mmap;          /* Made by mmap(), written back on munmap() */
+	enum vm_advice advice; /* ADV_NORMAL, ADV_RANDOM or ADV_SEQUENTIAL */
 };
 
 #include "threads/thread.h"
@@ -107,8 +150,47 @@ struct page *spt_find_page (struct supplemental_page_table *spt,
 		void *va);
 bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
+struct vma *vma_add (struct supplemental_page_table *spt, void *start,
+		size_t length, enum vm_type type, vm_initializer *init,
+		struct file *file, off_t offset, size_t read_bytes, bool writable);
+struct vma *vma_find (struct supplemental_page_table *spt, const void *va);
+void vma_remove (struct supplemental_page_table *spt, struct vma *vma);
+struct page *vma_get_page (struct supplemental_page_table *spt, void *va);
+bool vma_covers (struct supplemental_page_table *spt, void *addr,
+		size_t length, bool mmap_only);
+enum vm_advice vm_page_advice (struct page *page);
+bool vm_madvise (void *addr, size_t length, enum vm_advice advice);
+
+extern size_t reclaim_low_wmark;
+extern size_t reclaim_high_wmark;
+extern bool vm_large_pages;
+extern size_t vm_rss_limit;
+extern size_t merge_scan_cnt;
 
 void vm_init (void);
+void vm_print_stats (void);
+void vm_frame_table_init (void *base, size_t page_cnt);
+struct frame *vm_frame_lookup (void *kva);
+struct frame *vm_get_frame (void);
+struct frame *vm_try_get_frame (void);
+struct frame *vm_get_unowned_frame (void);
+struct frame *vm_try_get_unowned_frame (void);
+void vm_free_frame (struct frame *frame);
+void vm_frame_set_page (struct frame *frame, struct page *page);
+void vm_frame_link (struct frame *frame, struct page *page);
+struct frame *vm_frame_pin (struct page *page);
+void vm_frame_unpin (struct frame *frame);
+bool vm_frame_try_pin (struct page *page, struct frame **frame);
+bool vm_evicting (void);
+size_t vm_set_rss_limit (size_t pages);
+struct frame *vm_text_get (struct inode *inode, off_t ofs, uint32_t len,
+		bool mmap, struct page *page);
+bool vm_text_resident (struct inode *inode, off_t ofs, uint32_t len,
+		bool mmap);
+bool vm_text_add (struct frame *frame, struct inode *inode, off_t ofs,
+		uint32_t len, bool mmap);
+void vm_release_frame (struct page *page);
+bool vm_release_shared_frame (struct page *page);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 		bool write, bool not_present);
 
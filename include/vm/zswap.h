@@ -0,0 +1,15 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+#include <stdbool.h>
+
+struct zswap_entry;
+struct page;
+
+void zswap_init (void);
+struct zswap_entry *zswap_store (const void *kva, struct page *page);
+void zswap_dup (struct zswap_entry *e);
+bool zswap_load (struct zswap_entry *e, void *kva, int *slot);
+int zswap_release (struct zswap_entry *e);
+void zswap_print_stats (void);
+
+#endif
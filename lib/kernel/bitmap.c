@@ -326,6 +326,24 @@ bitmap_write (const struct bitmap *b, struct file *file) {
 	off_t size = byte_cnt (b->bit_cnt);
 	return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes to FILE only the part of B that holds the CNT bits
+   starting at START, widened to whole blocks of BLOCK_SIZE
+   bytes.  Return true if successful, false otherwise. */
+bool
+bitmap_write_part (const struct bitmap *b, struct file *file,
+		size_t start, size_t cnt, size_t block_size) {
+	off_t size = byte_cnt (b->bit_cnt);
+	off_t ofs, end;
+
+	ASSERT (cnt > 0 && start + cnt <= b->bit_cnt);
+	ofs = ROUND_DOWN (start / CHAR_BIT, block_size);
+	end = ROUND_UP ((start + cnt - 1) / CHAR_BIT + 1, block_size);
+	if (end > size)
+		end = size;
+	return file_write_at (file, (const uint8_t *) b->bits + ofs, end - ofs,
+			ofs) == end - ofs;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -155,6 +155,26 @@ munmap (void *addr) {
 	syscall1 (SYS_MUNMAP, addr);
 }
 
+int
+msync (void *addr, size_t length) {
+	return syscall2 (SYS_MSYNC, addr, length);
+}
+
+int
+madvise (void *addr, size_t length, int advice) {
+	return syscall3 (SYS_MADVISE, addr, length, advice);
+}
+
+size_t
+set_rss_limit (size_t pages) {
+	return syscall1 (SYS_SET_RSS_LIMIT, pages);
+}
+
+int
+fault_stats (struct fault_stats *st, bool all) {
+	return syscall2 (SYS_FAULT_STATS, st, all);
+}
+
 bool
 chdir (const char *dir) {
 	return syscall1 (SYS_CHDIR, dir);
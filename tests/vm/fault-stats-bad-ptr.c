@@ -0,0 +1,13 @@
+/* Passes a kernel address to the fault_stats system call.
+   The process must be terminated with -1 exit code. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  fault_stats ((struct fault_stats *) 0x8004000000, false);
+  fail ("should not have survived fault_stats()");
+}
@@ -0,0 +1,31 @@
+/* Fills an anonymous page, drops it with madvise(MADV_DONTNEED),
+   and verifies that the next touch finds it zero-filled. */
+
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+
+static char buf[3 * PAGE_SIZE];
+
+void
+test_main (void)
+{
+  char *page = (char *) ROUND_UP ((uintptr_t) buf, PAGE_SIZE);
+  size_t i;
+
+  msg ("fill page");
+  memset (page, 0xa5, PAGE_SIZE);
+
+  CHECK (madvise (page, PAGE_SIZE, MADV_DONTNEED) == 0,
+         "madvise page DONTNEED");
+
+  for (i = 0; i < PAGE_SIZE; i++)
+    if (page[i] != 0)
+      fail ("byte %zu is %02hhx after MADV_DONTNEED", i, page[i]);
+  msg ("page is zero-filled");
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(madvise-dontneed) begin
+(madvise-dontneed) fill page
+(madvise-dontneed) madvise page DONTNEED
+(madvise-dontneed) page is zero-filled
+(madvise-dontneed) end
+EOF
+pass;
@@ -0,0 +1,43 @@
+/* Caps the process at a few resident pages with set_rss_limit,
+   writes many more pages than that, and verifies that the
+   process had to evict its own pages and that every page still
+   reads back what was written. */
+
+#include <string.h>
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_COUNT 256
+#define RSS_LIMIT 32
+
+static char chunk[PAGE_COUNT * PAGE_SIZE];
+static struct fault_stats st;
+
+void
+test_main (void)
+{
+  size_t i;
+
+  set_rss_limit (RSS_LIMIT);
+  msg ("set rss limit to %d pages", RSS_LIMIT);
+
+  for (i = 0; i < PAGE_COUNT; i++)
+    memset (chunk + i * PAGE_SIZE, (char) i, PAGE_SIZE);
+  msg ("write %d pages", PAGE_COUNT);
+
+  for (i = 0; i < PAGE_COUNT; i++)
+    {
+      char *mem = chunk + i * PAGE_SIZE;
+      if (mem[0] != (char) i || mem[PAGE_SIZE - 1] != (char) i)
+        fail ("data is inconsistent in page %zu", i);
+    }
+  msg ("check consistency");
+
+  CHECK (fault_stats (&st, false) == 0, "get fault stats");
+  CHECK (st.cnt[FT_EVICT] > 0, "process evicted its own pages");
+
+  set_rss_limit (0);
+}
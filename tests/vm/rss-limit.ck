@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(rss-limit) begin
+(rss-limit) set rss limit to 32 pages
+(rss-limit) write 256 pages
+(rss-limit) check consistency
+(rss-limit) get fault stats
+(rss-limit) process evicted its own pages
+(rss-limit) end
+EOF
+pass;
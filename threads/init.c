@@ -31,6 +31,8 @@
 #include "tests/threads/tests.h"
 #ifdef VM
 #include "vm/vm.h"
+#include "vm/trace.h"
+#include "vm/zswap.h"
 #endif
 #ifdef FILESYS
 #include "devices/disk.h"
@@ -100,6 +102,7 @@ main (void) {
 #ifdef USERPROG
 	exception_init ();
 	syscall_init ();
+	exec_cache_init ();
 #endif
 	/* Start thread scheduler and enable interrupts. */
 	thread_start ();
@@ -226,6 +229,24 @@ parse_options (char **argv) {
 			user_page_limit = atoi (value);
 		else if (!strcmp (name, "-threads-tests"))
 			thread_tests = true;
+#endif
+#ifdef VM
+		else if (!strcmp (name, "-swap-ra"))
+			swap_readahead_window = atoi (value);
+		else if (!strcmp (name, "-fault-around"))
+			fault_around_window = atoi (value);
+		else if (!strcmp (name, "-reclaim-low"))
+			reclaim_low_wmark = atoi (value);
+		else if (!strcmp (name, "-reclaim-high"))
+			reclaim_high_wmark = atoi (value);
+		else if (!strcmp (name, "-fault-trace"))
+			fault_trace_size = atoi (value);
+		else if (!strcmp (name, "-no-large-pages"))
+			vm_large_pages = false;
+		else if (!strcmp (name, "-rss-limit"))
+			vm_rss_limit = atoi (value);
+		else if (!strcmp (name, "-merge"))
+			merge_scan_cnt = atoi (value);
 #endif
 		else
 			PANIC ("unknown option `%s' (use -h for help)", name);
@@ -246,6 +267,9 @@ run_task (char **argv) {
 	} else {
 		process_wait (process_create_initd (task));
 	}
+#ifdef VM
+	fault_trace_save ();
+#endif
 #else
 	run_test (task);
 #endif
@@ -328,6 +352,18 @@ usage (void) {
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+			"  -swap-ra=COUNT     Read up to COUNT swap slots per swap-in.\n"
+			"  -fault-around=COUNT  Load up to COUNT file pages per fault.\n"
+			"  -reclaim-low=COUNT   Start reclaiming below COUNT free frames.\n"
+			"  -reclaim-high=COUNT  Reclaim until COUNT frames are free.\n"
+			"  -fault-trace=COUNT   Save the last COUNT page faults to "
+			FAULT_TRACE_FILE ".\n"
+			"  -no-large-pages    Map 4 kB pages only.\n"
+			"  -rss-limit=COUNT   Limit each process to COUNT frames.\n"
+			"  -merge=COUNT       Merge identical anonymous pages, looking at\n"
+			"                     COUNT frames every 100 ms.\n"
 #endif
 			);
 	power_off ();
@@ -338,6 +374,9 @@ usage (void) {
    as long as we're running on Bochs or QEMU. */
 void
 power_off (void) {
+#ifdef USERPROG
+	exec_cache_done ();
+#endif
 #ifdef FILESYS
 	filesys_done ();
 #endif
@@ -361,4 +400,11 @@ print_stats (void) {
 #ifdef USERPROG
 	exception_print_stats ();
 #endif
+#ifdef VM
+	vm_print_stats ();
+	fault_stat_print ();
+	swap_print_stats ();
+	zswap_print_stats ();
+	page_cache_print_stats ();
+#endif
 }
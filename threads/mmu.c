@@ -8,11 +8,29 @@
 #include "threads/mmu.h"
 #include "intrinsic.h"
 
+/* Replaces large page PDE by a page table of 512 PTEs mapping the same
+ * frames with the same flags, so that they can be changed one by one. */
+static void
+pde_split (uint64_t *pde) {
+	uint64_t *pt = palloc_get_page (PAL_ASSERT);
+	uint64_t pa = PTE_ADDR (*pde) & ~(LGPGSIZE - 1);
+	uint64_t flags = *pde & PTE_FLAGS & ~(uint64_t) PTE_PS;
+
+	for (size_t i = 0; i < LGPG_PAGES; i++)
+		pt[i] = (pa + i * PGSIZE) | flags;
+	*pde = vtop (pt) | PTE_U | PTE_W | PTE_P;
+	/* Drop the 2 MiB TLB entry, in whichever address space is active. */
+	lcr3 (rcr3 ());
+}
+
 static uint64_t *
 pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 	int idx = PDX (va);
 	if (pdp) {
 		uint64_t *pte = (uint64_t *) pdp[idx];
+		/* A PTE of a large page only exists once it is split. */
+		if (((uint64_t) pte & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS))
+			pde_split (&pdp[idx]);
 		if (!((uint64_t) pte & PTE_P)) {
 			if (create) {
 				uint64_t *new_page = palloc_get_page (PAL_ZERO);
@@ -55,8 +73,24 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
 	return pte;
 }
 
+/* Returns the PDE of PML4 for VA if it maps a large page, without
+ * splitting it, or a null pointer. */
+static uint64_t *
+pml4_large_pde (uint64_t *pml4, const void *va) {
+	uint64_t e = pml4[PML4 (va)];
+
+	if (!(e & PTE_P))
+		return NULL;
+	e = ((uint64_t *) ptov (PTE_ADDR (e)))[PDPE (va)];
+	if (!(e & PTE_P))
+		return NULL;
+	uint64_t *pde = &((uint64_t *) ptov (PTE_ADDR (e)))[PDX (va)];
+	return (*pde & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS) ? pde : NULL;
+}
+
 /* Returns the address of the page table entry for virtual
  * address VADDR in page map level 4, pml4.
+ * A large page on the way is split first, see pde_split().
  * If PML4E does not have a page table for VADDR, behavior depends
  * on CREATE.  If CREATE is true, then a new page table is
  * created and a pointer into it is returned.  Otherwise, a null
@@ -122,6 +156,9 @@ pgdir_for_each (uint64_t *pdp, pte_for_each_func *func, void *aux,
 		unsigned pml4_index, unsigned pdp_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
+		/* Large pages only come with VM, which never walks them. */
+		if (((uint64_t) pte) & PTE_PS)
+			continue;
 		if (((uint64_t) pte) & PTE_P)
 			if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
 					pml4_index, pdp_index, i))
@@ -169,6 +206,9 @@ static void
 pgdir_destroy (uint64_t *pdp) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
+		/* The frames of a large page are not a page table. */
+		if (((uint64_t) pte) & PTE_PS)
+			continue;
 		if (((uint64_t) pte) & PTE_P)
 			pt_destroy (PTE_ADDR (pte));
 	}
@@ -214,6 +254,11 @@ void *
 pml4_get_page (uint64_t *pml4, const void *uaddr) {
 	ASSERT (is_user_vaddr (uaddr));
 
+	uint64_t *pde = pml4_large_pde (pml4, uaddr);
+	if (pde != NULL)
+		return ptov (PTE_ADDR (*pde) & ~(LGPGSIZE - 1))
+			+ ((uint64_t) uaddr & (LGPGSIZE - 1));
+
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) uaddr, 0);
 
 	if (pte && (*pte & PTE_P))
@@ -268,7 +313,9 @@ pml4_clear_page (uint64_t *pml4, void *upage) {
  * Returns false if PML4 contains no PTE for VPAGE. */
 bool
 pml4_is_dirty (uint64_t *pml4, const void *vpage) {
-	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+	uint64_t *pte = pml4_large_pde (pml4, vpage);
+	if (pte == NULL)
+		pte = pml4e_walk (pml4, (uint64_t) vpage, false);
 	return pte != NULL && (*pte & PTE_D) != 0;
 }
 
@@ -294,15 +341,20 @@ pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
  * PML4 contains no PTE for VPAGE. */
 bool
 pml4_is_accessed (uint64_t *pml4, const void *vpage) {
-	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+	uint64_t *pte = pml4_large_pde (pml4, vpage);
+	if (pte == NULL)
+		pte = pml4e_walk (pml4, (uint64_t) vpage, false);
 	return pte != NULL && (*pte & PTE_A) != 0;
 }
 
 /* Sets the accessed bit to ACCESSED in the PTE for virtual page
-   VPAGE in PD. */
+   VPAGE in PD.  For a large page that is the bit of the whole of
+   it, which is left unsplit. */
 void
 pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
-	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+	uint64_t *pte = pml4_large_pde (pml4, vpage);
+	if (pte == NULL)
+		pte = pml4e_walk (pml4, (uint64_t) vpage, false);
 	if (pte) {
 		if (accessed)
 			*pte |= PTE_A;
@@ -313,3 +365,47 @@ pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
 			invlpg ((uint64_t) vpage);
 	}
 }
+
+/* Sets the writable bit to WRITABLE in the PTE for virtual page
+   VPAGE in PML4.  Other bits, dirty and accessed included, are
+   preserved. */
+void
+pml4_set_writable (uint64_t *pml4, const void *vpage, bool writable) {
+	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+	if (pte) {
+		if (writable)
+			*pte |= PTE_W;
+		else
+			*pte &= ~(uint64_t) PTE_W;
+
+		if (rcr3 () == vtop (pml4))
+			invlpg ((uint64_t) vpage);
+	}
+}
+
+/* Maps the 2 MiB at user virtual address UPAGE to the physically
+   contiguous frames at KPAGE with one large page PDE. Both must be
+   2 MiB aligned, and no page of the range may be mapped yet.
+   Returns false if memory is short or a page is mapped. */
+bool
+pml4_set_large_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
+	uint64_t *pt, *pde;
+
+	ASSERT ((uint64_t) upage % LGPGSIZE == 0);
+	ASSERT (vtop (kpage) % LGPGSIZE == 0);
+	ASSERT (is_user_vaddr (upage));
+	ASSERT (pml4 != base_pml4);
+
+	/* Builds the upper levels, and a page table that is dropped. */
+	if (pml4e_walk (pml4, (uint64_t) upage, 1) == NULL)
+		return false;
+	pde = &((uint64_t *) ptov (PTE_ADDR (((uint64_t *) ptov (PTE_ADDR (
+				pml4[PML4 (upage)])))[PDPE (upage)])))[PDX (upage)];
+	pt = ptov (PTE_ADDR (*pde));
+	for (size_t i = 0; i < LGPG_PAGES; i++)
+		if (pt[i] & PTE_P)
+			return false;
+	palloc_free_page (pt);
+	*pde = vtop (kpage) | PTE_PS | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+	return true;
+}
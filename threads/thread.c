@@ -649,7 +649,6 @@ init_thread (struct thread *t, const char *name, int priority) {
 
 	t->tf.rsp = (uint64_t) t + PGSIZE - sizeof (void *);
 	list_init(&(t->opfile_list));
-	list_init(&(t->mmfile_list));
 	list_init(&(t->child_list));
 	t->priority = priority;
 	t->magic = THREAD_MAGIC;
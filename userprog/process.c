@@ -10,9 +10,11 @@
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
@@ -28,6 +30,7 @@
 static void process_cleanup (void);
 static bool load (const char *file_name, struct intr_frame *if_);
 static void initd (void *f_name);
+static struct list exec_cache;
 static void __do_fork (void *aux, struct intr_frame *pf);
 
 int put_arg(struct intr_frame *_if, char *save_ptr, uint64_t *argadd) ;
@@ -49,6 +52,7 @@ tid_t
 process_create_initd (const char *file_name) {
 	char *fn_copy;
 	tid_t tid;
+
 	/* Make a copy of FILE_NAME.
 	 * Otherwise there's a race between the caller and load(). */
 	fn_copy = palloc_get_page (0);
@@ -83,6 +87,9 @@ initd (void *f_name) {
 	tchild -> child = thread_current();
 	tchild -> tid = thread_current() -> tid;
 	list_push_back(&(thread_current()->parent->child_list), &(tchild->elem));
+#ifdef VM
+	thread_current ()->rss_limit = vm_rss_limit;
+#endif
 	process_init ();
 
 	if (process_exec (f_name) < 0)
@@ -191,6 +198,7 @@ __do_fork (void *aux, struct intr_frame *pf) {           //자식에서 하는
 	process_activate (current);
 
 #ifdef VM
+	current->rss_limit = parent->rss_limit;
 	supplemental_page_table_init (&current->spt);
 	if (!supplemental_page_table_copy (&current->spt, &parent->spt)){
 		goto error;
@@ -402,30 +410,12 @@ process_wait (tid_t child_tid UNUSED) {
 void
 process_exit () {
 	
+#ifdef VM
+	/* Write back mappings while the disk can still interrupt us. */
+	do_munmap_all ();
+#endif
 	enum intr_level old_level = intr_disable();
 	struct thread *curr = thread_current ();
-	struct list_elem *e2;
-	struct list_elem *e3;
-	struct mm_file* f;
-	struct page *page = NULL;
-	struct page_addr* paddr;
-	for (e2 = list_begin (&(curr->mmfile_list)); e2 != list_end (&(curr->mmfile_list)); e2 = list_next (e2)) {
-		f = list_entry (e2, struct mm_file, elem);
-		for (e3 = list_begin (&(f -> page_list)); e3 != list_end (&(f-> page_list));) {
-			paddr = list_entry (e3, struct page_addr, elem);
-			page = spt_find_page(&curr->spt, paddr->addr);
-			e3 = list_next (e3);
-			if (page){
-				if(pml4_is_dirty(curr->pml4, page->va)){
-					intr_set_level(old_level);
-					file_write_at(paddr -> file, paddr -> addr, paddr -> size, paddr -> offset);
-					old_level = intr_disable();
-				}
-				hash_delete(curr->spt.hash_table, &(page->elem));
-				free(paddr);
-			}
-		}
-	}
 	if(curr->pml4 == NULL)
 		goto die;
 	if(curr->parent->tid == 1){
@@ -605,35 +595,112 @@ static bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
 		uint32_t read_bytes, uint32_t zero_bytes,
 		bool writable);
 
-/* Loads an ELF executable from FILE_NAME into the current thread.
- * Stores the executable's entry point into *RIP
- * and its initial stack pointer into *RSP.
- * Returns true if successful, false otherwise. */
-static bool
-load (const char *file_name, struct intr_frame *if_) {
-	struct thread *t = thread_current ();
+/* One PT_LOAD segment, as load_segment() takes it. */
+struct exec_seg {
+	uint64_t file_page;
+	uint64_t mem_page;
+	uint32_t read_bytes;
+	uint32_t zero_bytes;
+	bool writable;
+};
+
+/* The validated layout of an executable. */
+struct exec_image {
+	struct list_elem elem;      /* In EXEC_CACHE. */
+	struct inode *inode;        /* Held open while cached. */
+	unsigned write_cnt;         /* inode_write_cnt() when it was read. */
+	uint64_t entry;             /* Start address. */
+	int seg_cnt;
+	struct exec_seg segs[];
+};
+
+/* Layouts of the executables run last, most recent first, so that
+ * running one again does not read and check its headers. An entry is
+ * dropped once its file is written. Protected by the file lock. */
+#define EXEC_CACHE_SIZE 8
+
+static size_t
+exec_image_size (int seg_cnt) {
+	return sizeof (struct exec_image) + seg_cnt * sizeof (struct exec_seg);
+}
+
+static void
+exec_cache_remove (struct exec_image *image) {
+	list_remove (&image->elem);
+	inode_close (image->inode);
+	free (image);
+}
+
+/* Initializes the executable cache. Called once, at boot. */
+void
+exec_cache_init (void) {
+	list_init (&exec_cache);
+}
+
+/* Empties the executable cache, closing the files it holds open. Called at
+ * shutdown, before the file system is done. */
+void
+exec_cache_done (void) {
+	file_lock_acquire ();
+	while (!list_empty (&exec_cache))
+		exec_cache_remove (list_entry (list_front (&exec_cache),
+					struct exec_image, elem));
+	file_lock_release ();
+}
+
+/* Returns a copy of the cached layout of INODE, to be freed by the
+ * caller, or NULL. Drops stale entries on the way. */
+static struct exec_image *
+exec_cache_find (struct inode *inode) {
+	struct list_elem *e, *next;
+	struct exec_image *copy;
+
+	for (e = list_begin (&exec_cache); e != list_end (&exec_cache); e = next) {
+		struct exec_image *image = list_entry (e, struct exec_image, elem);
+		next = list_next (e);
+
+		if (inode_is_removed (image->inode)
+				|| image->write_cnt != inode_write_cnt (image->inode)) {
+			exec_cache_remove (image);
+			continue;
+		}
+		if (image->inode != inode)
+			continue;
+
+		list_remove (e);
+		list_push_front (&exec_cache, e);
+		copy = malloc (exec_image_size (image->seg_cnt));
+		if (copy != NULL)
+			memcpy (copy, image, exec_image_size (image->seg_cnt));
+		return copy;
+	}
+	return NULL;
+}
+
+/* Caches a copy of IMAGE, the layout of INODE. */
+static void
+exec_cache_add (struct inode *inode, const struct exec_image *image) {
+	struct exec_image *copy = malloc (exec_image_size (image->seg_cnt));
+
+	if (copy == NULL)
+		return;
+	memcpy (copy, image, exec_image_size (image->seg_cnt));
+	copy->inode = inode_reopen (inode);
+	copy->write_cnt = inode_write_cnt (inode);
+	list_push_front (&exec_cache, &copy->elem);
+	if (list_size (&exec_cache) > EXEC_CACHE_SIZE)
+		exec_cache_remove (list_entry (list_back (&exec_cache),
+					struct exec_image, elem));
+}
+
+/* Reads and checks the headers of executable FILE. Returns its layout,
+ * to be freed by the caller, or NULL if it is not one we can run. */
+static struct exec_image *
+exec_parse (struct file *file) {
+	struct exec_image *image = NULL;
 	struct ELF ehdr;
-	struct file *file = NULL;
 	off_t file_ofs;
-	bool success = false;
 	int i;
-	/* Allocate and activate page directory. */
-	t->pml4 = pml4_create ();
-	if (t->pml4 == NULL)
-		goto done;
-	process_activate (thread_current ());
-
-	/* Open executable file. */
-	file_lock_acquire();
-	file = filesys_open (file_name);
-	file_lock_release();
-	if (file == NULL) {
-		printf ("load: %s: open failed\n", file_name);
-		printf("%d listsize\n", list_size(&thread_current ()->mmfile_list));
-		process_exit();
-		printf("returned from exit!\n");
-		return false;
-	}
 
 	/* Read and verify executable header. */
 	file_lock_acquire();
@@ -645,10 +712,16 @@ load (const char *file_name, struct intr_frame *if_) {
 			|| ehdr.e_phentsize != sizeof (struct Phdr)
 			|| ehdr.e_phnum > 1024) {
 		file_lock_release();
-		printf ("load: %s: error loading executable\n", file_name);
-		goto done;
+		return NULL;
 	}
 	file_lock_release();
+
+	image = malloc (exec_image_size (ehdr.e_phnum));
+	if (image == NULL)
+		return NULL;
+	image->entry = ehdr.e_entry;
+	image->seg_cnt = 0;
+
 	/* Read program headers. */
 	file_ofs = ehdr.e_phoff;
 	for (i = 0; i < ehdr.e_phnum; i++) {
@@ -656,16 +729,12 @@ load (const char *file_name, struct intr_frame *if_) {
 		file_lock_acquire();
 		if (file_ofs < 0 || file_ofs > file_length (file)){
 			file_lock_release();
-			goto done;
+			goto fail;
 		}
-		file_lock_release();
-		file_lock_acquire();
 		file_seek (file, file_ofs);
-		file_lock_release();
-		file_lock_acquire();
 		if (file_read (file, &phdr, sizeof phdr) != sizeof phdr){
 			file_lock_release();
-			goto done;
+			goto fail;
 		}
 		file_lock_release();
 		file_ofs += sizeof phdr;
@@ -680,42 +749,94 @@ load (const char *file_name, struct intr_frame *if_) {
 			case PT_DYNAMIC:
 			case PT_INTERP:
 			case PT_SHLIB:
-				goto done;
+				goto fail;
 			case PT_LOAD:
 				if (validate_segment (&phdr, file)) {
-					bool writable = (phdr.p_flags & PF_W) != 0;
-					uint64_t file_page = phdr.p_offset & ~PGMASK;
-					uint64_t mem_page = phdr.p_vaddr & ~PGMASK;
+					struct exec_seg *seg = &image->segs[image->seg_cnt++];
 					uint64_t page_offset = phdr.p_vaddr & PGMASK;
-					uint32_t read_bytes, zero_bytes;
+					seg->writable = (phdr.p_flags & PF_W) != 0;
+					seg->file_page = phdr.p_offset & ~PGMASK;
+					seg->mem_page = phdr.p_vaddr & ~PGMASK;
 					if (phdr.p_filesz > 0) {
 						/* Normal segment.
 						 * Read initial part from disk and zero the rest. */
-						read_bytes = page_offset + phdr.p_filesz;
-						zero_bytes = (ROUND_UP (page_offset + phdr.p_memsz, PGSIZE)
-								- read_bytes);
+						seg->read_bytes = page_offset + phdr.p_filesz;
+						seg->zero_bytes = (ROUND_UP (page_offset + phdr.p_memsz, PGSIZE)
+								- seg->read_bytes);
 					} else {
 						/* Entirely zero.
 						 * Don't read anything from disk. */
-						read_bytes = 0;
-						zero_bytes = ROUND_UP (page_offset + phdr.p_memsz, PGSIZE);
+						seg->read_bytes = 0;
+						seg->zero_bytes = ROUND_UP (page_offset + phdr.p_memsz, PGSIZE);
 					}
-					if (!load_segment (file, file_page, (void *) mem_page,
-								read_bytes, zero_bytes, writable))
-						goto done;
 				}
 				else
-					goto done;
+					goto fail;
 				break;
 		}
 	}
+	return image;
+
+fail:
+	free (image);
+	return NULL;
+}
+
+/* Loads an ELF executable from FILE_NAME into the current thread.
+ * Stores the executable's entry point into *RIP
+ * and its initial stack pointer into *RSP.
+ * Returns true if successful, false otherwise. */
+static bool
+load (const char *file_name, struct intr_frame *if_) {
+	struct thread *t = thread_current ();
+	struct exec_image *image = NULL;
+	struct file *file = NULL;
+	bool success = false;
+	int i;
+	/* Allocate and activate page directory. */
+	t->pml4 = pml4_create ();
+	if (t->pml4 == NULL)
+		goto done;
+	process_activate (thread_current ());
+
+	/* Open executable file. */
+	file_lock_acquire();
+	file = filesys_open (file_name);
+	file_lock_release();
+	if (file == NULL) {
+		printf ("load: %s: open failed\n", file_name);
+		process_exit();
+		return false;
+	}
+
+	/* Find the segment layout, reading the headers only if needed. */
+	file_lock_acquire();
+	image = exec_cache_find (file_get_inode (file));
+	file_lock_release();
+	if (image == NULL) {
+		image = exec_parse (file);
+		if (image == NULL) {
+			printf ("load: %s: error loading executable\n", file_name);
+			goto done;
+		}
+		file_lock_acquire();
+		exec_cache_add (file_get_inode (file), image);
+		file_lock_release();
+	}
+
+	for (i = 0; i < image->seg_cnt; i++) {
+		struct exec_seg *seg = &image->segs[i];
+		if (!load_segment (file, seg->file_page, (void *) seg->mem_page,
+					seg->read_bytes, seg->zero_bytes, seg->writable))
+			goto done;
+	}
 
 	/* Set up stack. */
 	if (!setup_stack (if_))
 		goto done;
 
 	/* Start address. */
-	if_->rip = ehdr.e_entry;
+	if_->rip = image->entry;
 
 	/* TODO: Your code goes here.
 	 * TODO: Implement argument passing (see project2/argument_passing.html). */
@@ -723,6 +844,7 @@ load (const char *file_name, struct intr_frame *if_) {
 	success = true;
 
 done:
+	free (image);
 	return success;
 }
 
@@ -868,55 +990,20 @@ install_page (void *upage, void *kpage, bool writable) {
 /* From here, codes will be used after project 3.
  * If you want to implement the function for only project 2, implement it on the
  * upper block. */
-struct lazyload{
-	struct file *file;
-	uint8_t *upage;
-	uint32_t read_bytes; 
-	uint32_t zero_bytes;
-	off_t ofs;
-	bool writable;
-};
-
-static bool
-install_page (void *upage, void *kpage, bool writable) {
-	struct thread *t = thread_current ();
-	/* Verify that there's not already a page at that virtual
-	 * address, then map our page there. */
-	pml4_clear_page(t->pml4, upage);
-	return (pml4_get_page (t->pml4, upage) == NULL
-			&& pml4_set_page (t->pml4, upage, kpage, writable));
-}
-
-
 static bool
-lazy_load_segment (struct page *page, void *aux1) {
+lazy_load_segment (struct page *page, void *aux) {
 	/* TODO: Load the segment from the file */
 	/* TODO: This called when the first page fault occurs on address VA. */
 	/* TODO: VA is available when calling this function. */
-	struct lazyload * aux = (struct lazyload *) aux1;
+	bool success;
 
-	file_seek (aux->file, aux->ofs); 
-	/* Load this page. */
-	uint8_t *kpage = page->frame->kva;
-	
-	if (file_read (aux->file, kpage, aux->read_bytes) != (int) aux->read_bytes) {
-		palloc_free_page (kpage);
-		printf("false pass1!\n");
-		return false;
-	}
-	/* Add the page to the process's address space. */	
-	memset (kpage + aux -> read_bytes, 0, aux -> zero_bytes);
-	if (!install_page (aux->upage, kpage, aux->writable)) {
-		palloc_free_page (kpage);
-		printf("false pass2!\n");
-		return false;
-	}
-	page->frame->kva = pml4_get_page(thread_current()->pml4, page->va);
-	pml4_set_dirty(thread_current()->pml4, page->va, false);
-	if(pml4_is_dirty(thread_current()->pml4, page->va)){
-		printf("born dirty page\n");
-	}
-	return true;
+	if (VM_TYPE (page->operations->type) == VM_FILE)
+		page->file.aux = aux;
+	success = lazyload_around (page, aux, lazy_load_segment);
+	/* Anonymous pages have nowhere to keep AUX once loaded. */
+	if (VM_TYPE (page->operations->type) != VM_FILE)
+		free (aux);
+	return success;
 }
 
 /* Loads a segment starting at offset OFS in FILE at address
@@ -940,46 +1027,36 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 	ASSERT (pg_ofs (upage) == 0);
 	ASSERT (ofs % PGSIZE == 0);
 
-	off_t ofs_check = ofs;
-	while (read_bytes > 0 || zero_bytes > 0) {
-		/* Do calculate how to fill this page.
-		 * We will read PAGE_READ_BYTES bytes from FILE
-		 * and zero the final PAGE_ZERO_BYTES bytes. */
-		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-		size_t page_zero_bytes = PGSIZE - page_read_bytes;
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct vma *vma;
 
-		/* TODO: Set up aux to pass information to the lazy_load_segment. */	
-		
-
-		void *aux = NULL;
-		struct lazyload *aux1 = (struct lazyload *)malloc(sizeof(struct lazyload));
-		aux1 -> file = (uint64_t)file;
-		aux1 -> upage = upage;
-		aux1 -> read_bytes = page_read_bytes;
-		aux1 -> zero_bytes = page_zero_bytes;
-		aux1 -> writable = writable;
-
-		aux1 -> ofs = ofs_check;
-		ofs_check += (page_read_bytes);
-		aux = aux1;
-		
-		if (!vm_alloc_page_with_initializer (VM_ANON, upage,
-					writable, lazy_load_segment, aux))
-			return false;
-		/* Advance. */
+	/* A page the previous segment ends in stays as that segment maps it. */
+	while ((read_bytes > 0 || zero_bytes > 0) && vma_find (spt, upage)) {
+		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
 		read_bytes -= page_read_bytes;
-		zero_bytes -= page_zero_bytes;
+		zero_bytes -= PGSIZE - page_read_bytes;
+		ofs += PGSIZE;
 		upage += PGSIZE;
 	}
+	if (read_bytes == 0 && zero_bytes == 0)
+		return true;
+
+	/* Pages are made when first touched, see vma_get_page().
+	 * Read-only segments are shared text, see vm/file.c. */
+	vma = vma_add (spt, upage, read_bytes + zero_bytes,
+			writable ? VM_ANON : VM_FILE, lazy_load_segment, file, ofs,
+			read_bytes, writable);
+	if (vma == NULL)
+		return false;
+	vma->is_text = !writable;
+	if (vma->is_text)
+		file_map_text_area (spt, vma);
 	return true;
 }
 
 /* Create a PAGE of stack at the USER_STACK. Return true on success. */
 static bool
 setup_stack (struct intr_frame *if_) {
-	struct page *kpage= malloc(sizeof(struct page));
-	struct frame *frame = malloc(sizeof(struct frame));
-	uint8_t *kva = palloc_get_page (PAL_USER | PAL_ZERO);
 	bool success = false;
 	void *stack_bottom = (void *) (((uint8_t *) USER_STACK) - PGSIZE);
 
@@ -987,24 +1064,13 @@ setup_stack (struct intr_frame *if_) {
 	 * TODO: If success, set the rsp accordingly.
 	 * TODO: You should mark the page is stack. */
 	/* TODO: Your code goes here */ 
-	frame -> page = kpage;
-	kpage -> frame = frame;
-	kpage -> writable = true;
-
-	kpage -> va = stack_bottom;
-	if (kpage != NULL) {
-		success = install_page (stack_bottom, kva, true);
-		if (success){
+	if (vm_alloc_page (VM_ANON | VM_MARKER_0, stack_bottom, true)) {
+		success = vm_claim_page (stack_bottom);
+		if (success) {
 			if_->rsp = USER_STACK;
-			frame->kva = pml4_get_page(thread_current()->pml4, kpage->va);
+			spt_find_page (&thread_current ()->spt, stack_bottom)->is_stack = true;
 		}
-		else
-			palloc_free_page (frame);
 	}
-	kpage->frame->kva = kva;
-	anon_initializer(kpage, VM_ANON, NULL);
-	spt_insert_page(&thread_current()->spt, kpage);
-	kpage -> is_stack = true;
 	return success;
 }
 #endif /* VM */
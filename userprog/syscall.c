@@ -51,6 +51,10 @@ int dup2(int oldfd, int newfd);
 // project 3
 void *mmap (void *addr, size_t length, int writable, int fd, off_t offset);
 void munmap (void *addr);
+int msync (void *addr, size_t length);
+int madvise (void *addr, size_t length, int advice);
+size_t set_rss_limit (size_t pages);
+int fault_stats (struct fault_stats *st, bool all);
 // void print_regi(struct intr_frame *f);
 
 int64_t find_file(int fd);
@@ -196,6 +200,26 @@ syscall_handler (struct intr_frame *f UNUSED) {
 			void* addr = f->R.rdi;
 			munmap (addr);
 			break;}	
+		case SYS_MSYNC :{
+			void* addr = f->R.rdi;
+			size_t length = f->R.rsi;
+			f-> R.rax = msync (addr, length);
+			break;}
+		case SYS_MADVISE :{
+			void* addr = f->R.rdi;
+			size_t length = f->R.rsi;
+			int advice = f->R.rdx;
+			f-> R.rax = madvise (addr, length, advice);
+			break;}
+		case SYS_SET_RSS_LIMIT :{
+			size_t pages = f->R.rdi;
+			f-> R.rax = set_rss_limit (pages);
+			break;}
+		case SYS_FAULT_STATS :{
+			struct fault_stats *st = (struct fault_stats *) f->R.rdi;
+			bool all = f->R.rsi;
+			f-> R.rax = fault_stats (st, all);
+			break;}
 	}
 	// thread_exit ();
 }
@@ -382,7 +406,8 @@ filesize (int fd) {
 
 int
 read (int fd, void *buffer, unsigned size) {
-	if(!is_user_vaddr(buffer)||!spt_find_page(&thread_current()->spt, buffer)->writable){
+	struct page *bpage = is_user_vaddr(buffer) ? vma_get_page(&thread_current()->spt, buffer) : NULL;
+	if(bpage == NULL||!bpage->writable){
 		thread_exit();
 	}
 	file_lock_acquire();
@@ -575,6 +600,29 @@ void munmap (void *addr){
 	do_munmap(addr);
 }
 
+int msync (void *addr, size_t length){
+	return do_msync(addr, length) ? 0 : -1;
+}
+
+int madvise (void *addr, size_t length, int advice){
+	return vm_madvise(addr, length, advice) ? 0 : -1;
+}
+
+size_t set_rss_limit (size_t pages){
+	return vm_set_rss_limit(pages);
+}
+
+int fault_stats (struct fault_stats *st, bool all){
+	uint8_t *p = (uint8_t *) st;
+	for (uint8_t *upage = pg_round_down (p); upage < p + sizeof *st; upage += PGSIZE) {
+		struct page *page = is_user_vaddr (upage) ? vma_get_page (&thread_current ()->spt, upage) : NULL;
+		if (page == NULL || !page->writable)
+			exit (-1);
+	}
+	fault_stat_get (st, all);
+	return 0;
+}
+
 
 
 void
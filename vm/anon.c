@@ -1,16 +1,51 @@
 /* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page). */
 
 #include "vm/vm.h"
+#include "vm/zswap.h"
 #include "devices/disk.h"
 #include "threads/mmu.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include <bitmap.h>
+#include <stdio.h>
+#include <string.h>
 
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
 static bool anon_swap_in (struct page *page, void *kva);
 static bool anon_swap_out (struct page *page);
 static void anon_destroy (struct page *page);
+static bool anon_read_slot (struct page *page, void *kva);
+static bool anon_swap_out_zswap (struct page *page);
 
-int disk_cnt = 0;
+/* Number of swap disk sectors that hold one page. */
+#define SECTORS_PER_SLOT (PGSIZE / DISK_SECTOR_SIZE)
+
+/* Swap slot allocator. One bit per page-sized slot of the swap disk, set
+ * while the slot holds a page. SWAP_REFS counts the pages that share a slot
+ * after fork and SWAP_PAGES is the page held by each unshared slot.
+ * SWAP_HINT is where the next search starts, so pages swapped out one after
+ * another land in adjacent slots. */
+static struct bitmap *swap_table;
+static uint8_t *swap_refs;
+static struct page **swap_pages;
+static size_t swap_hint;
+static size_t swap_used_cnt;
+static struct lock swap_lock;
+
+/* Staging area for clustered swap-out and swap readahead, big enough for
+ * the largest single disk transfer. */
+#define SWAP_BOUNCE_PAGES (DISK_MAX_SECTORS / SECTORS_PER_SLOT)
+static uint8_t *swap_bounce;
+static struct lock swap_bounce_lock;
+
+/* Number of swap slots read per swap-in, including the faulting one.
+ * Set with -swap-ra=N; 1 turns readahead off. */
+size_t swap_readahead_window = SWAP_CLUSTER;
+
+/* Readahead pages installed by a later fault, and ones dropped unused. */
+static long long swap_ra_hit_cnt;
+static long long swap_ra_miss_cnt;
 
 /* DO NOT MODIFY this struct */
 static const struct page_operations anon_ops = {
@@ -24,56 +59,440 @@ static const struct page_operations anon_ops = {
 void
 vm_anon_init (void) {
 	/* TODO: Set up the swap_disk. */
+	if (swap_table != NULL)
+		return;
+	zswap_init ();
 	swap_disk = disk_get(1, 1);
+	if (swap_disk == NULL)
+		return;
+
+	size_t slot_cnt = disk_size (swap_disk) / SECTORS_PER_SLOT;
+	swap_table = bitmap_create (slot_cnt);
+	swap_refs = calloc (slot_cnt, sizeof *swap_refs);
+	swap_pages = calloc (slot_cnt, sizeof *swap_pages);
+	if (swap_table == NULL || swap_refs == NULL || swap_pages == NULL)
+		PANIC ("vm_anon_init: cannot allocate swap table");
+	swap_hint = 0;
+	swap_used_cnt = 0;
+	lock_init (&swap_lock);
+
+	swap_bounce = palloc_get_multiple (PAL_ASSERT, SWAP_BOUNCE_PAGES);
+	lock_init (&swap_bounce_lock);
+	if (swap_readahead_window < 1)
+		swap_readahead_window = 1;
+	if (swap_readahead_window > SWAP_BOUNCE_PAGES)
+		swap_readahead_window = SWAP_BOUNCE_PAGES;
+}
+
+/* Allocates CNT adjacent swap slots and returns the first one, or
+ * BITMAP_ERROR if the swap disk has no such run left. */
+size_t
+swap_slot_alloc (size_t cnt) {
+	size_t slot;
+
+	if (swap_table == NULL)
+		return BITMAP_ERROR;
+	lock_acquire (&swap_lock);
+	slot = bitmap_scan_and_flip (swap_table, swap_hint, cnt, false);
+	if (slot == BITMAP_ERROR)
+		slot = bitmap_scan_and_flip (swap_table, 0, cnt, false);
+	if (slot != BITMAP_ERROR) {
+		for (size_t i = 0; i < cnt; i++)
+			swap_refs[slot + i] = 1;
+		swap_hint = slot + cnt;
+		swap_used_cnt += cnt;
+	}
+	lock_release (&swap_lock);
+	return slot;
+}
+
+/* Drops one reference to swap SLOT, freeing it on the last one. */
+void
+swap_slot_free (size_t slot) {
+	lock_acquire (&swap_lock);
+	ASSERT (bitmap_test (swap_table, slot));
+	swap_pages[slot] = NULL;
+	if (--swap_refs[slot] == 0) {
+		bitmap_reset (swap_table, slot);
+		swap_used_cnt--;
+	}
+	lock_release (&swap_lock);
+}
+
+/* Adds a reference to swap SLOT, for another page holding its contents. */
+void
+swap_slot_dup (size_t slot) {
+	lock_acquire (&swap_lock);
+	ASSERT (bitmap_test (swap_table, slot));
+	swap_pages[slot] = NULL;
+	swap_refs[slot]++;
+	lock_release (&swap_lock);
+}
+
+/* Records PAGE as the only page holding swap SLOT, for readahead. */
+void
+swap_slot_set_page (size_t slot, struct page *page) {
+	lock_acquire (&swap_lock);
+	ASSERT (bitmap_test (swap_table, slot));
+	swap_pages[slot] = page;
+	lock_release (&swap_lock);
+}
+
+/* Returns true if fewer than an eighth of the swap slots are free. */
+static bool
+swap_is_low (void) {
+	size_t slot_cnt = bitmap_size (swap_table);
+	return slot_cnt - swap_used_cnt < slot_cnt / 8;
+}
+
+/* Stores the swap readahead pages installed by a later fault, and those
+ * dropped unused, system-wide, into *HIT and *MISS. */
+void
+swap_ra_stats (uint64_t *hit, uint64_t *miss) {
+	*hit = swap_ra_hit_cnt;
+	*miss = swap_ra_miss_cnt;
+}
+
+/* Prints swap slot usage. */
+void
+swap_print_stats (void) {
+	if (swap_table == NULL)
+		return;
+	printf ("Swap: %zu slots used, %zu free\n", swap_used_cnt,
+			bitmap_size (swap_table) - swap_used_cnt);
+	printf ("Swap: readahead of %zu pages, %lld hits, %lld misses\n",
+			swap_readahead_window, swap_ra_hit_cnt, swap_ra_miss_cnt);
+}
+
+/* Writes the page at KVA to swap SLOT, with one disk command. */
+void
+swap_write_slot (size_t slot, const void *kva) {
+	disk_write_multiple (swap_disk, slot * SECTORS_PER_SLOT, SECTORS_PER_SLOT,
+			kva);
 }
 
 /* Initialize the file mapping */
 bool
 anon_initializer (struct page *page, enum vm_type type, void *kva) {
 	/* Set up the handler */
-	page->operations = &anon_ops;	
+	page->operations = &anon_ops;
 	struct anon_page *anon_page = &page->anon;
 	anon_page->disk_n = -1;
+	anon_page->staged = false;
+	anon_page->zswap = NULL;
+	return true;
+}
+
+/* Fixes up the anonymous page CHILD that fork copied from its parent. A
+ * resident page drops the parent's slot, since the frame may be written
+ * before it is swapped out again; a swapped out page shares the slot. */
+void
+anon_fork_page (struct page *child) {
+	struct anon_page *anon_page = &child->anon;
+
+	/* Readahead data belongs to the parent; the child reads the slot. */
+	if (anon_page->staged) {
+		anon_page->staged = false;
+		child->frame = NULL;
+	}
+	if (anon_page->zswap != NULL) {
+		zswap_dup (anon_page->zswap);
+		return;
+	}
+	if (anon_page->disk_n == -1)
+		return;
+	if (child->frame != NULL) {
+		anon_page->disk_n = -1;
+		return;
+	}
+	swap_slot_dup (anon_page->disk_n);
 }
 
-/* Swap in the page by read contents from the swap disk. */
+/* Returns true if swap SLOT holds a page of the current process that is
+ * not resident, which makes it worth reading ahead. */
+static bool
+swap_slot_readahead_ok (size_t slot) {
+	struct page *page = swap_pages[slot];
+	return page != NULL && swap_refs[slot] == 1
+		&& page->owner == thread_current () && page->frame == NULL;
+}
+
+/* Reads swap slots [LO, HI) with one disk transfer. Slot SLOT goes to
+ * KVA; each other slot in the run is staged in the frame STAGED[i - LO]
+ * of its page, to be installed by the next fault on it without I/O. */
+static void
+swap_read_run (size_t lo, size_t hi, size_t slot, void *kva,
+		struct frame **staged) {
+	lock_acquire (&swap_bounce_lock);
+	disk_read_multiple (swap_disk, lo * SECTORS_PER_SLOT,
+			(hi - lo) * SECTORS_PER_SLOT, swap_bounce);
+	for (size_t i = lo; i < hi; i++) {
+		uint8_t *src = swap_bounce + (i - lo) * PGSIZE;
+		struct frame *frame = staged[i - lo];
+		if (i == slot)
+			memcpy (kva, src, PGSIZE);
+		else if (frame != NULL) {
+			struct page *page = swap_pages[i];
+			memcpy (frame->kva, src, PGSIZE);
+			vm_frame_link (frame, page);
+			page->anon.staged = true;
+			frame->pinned = false;
+		}
+	}
+	lock_release (&swap_bounce_lock);
+}
+
+/* Swap in the page by decompressing it, or else by reading it from the
+ * swap disk. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
 	struct anon_page *anon_page = &page->anon;
-	struct frame *frame = malloc(sizeof(struct frame));
-	page->frame = frame;
-	frame->page = page;
-	for(int i = 0; i < 8; i++) {
-		disk_read (swap_disk, (anon_page->disk_n) * 8 + i, (void *)kva + DISK_SECTOR_SIZE * i);
+
+	if (anon_page->zswap != NULL) {
+		int slot;
+		bool loaded = zswap_load (anon_page->zswap, kva, &slot);
+		anon_page->zswap = NULL;
+		anon_page->disk_n = slot;
+		if (loaded)
+			return true;
 	}
-	pml4_set_page (thread_current()->pml4, page->va, kva, true);
-	frame->kva = pml4_get_page (thread_current()->pml4, page->va);
+	/* Never written out, so all zeroes, like the frame it gets. */
+	if (anon_page->disk_n == -1)
+		return true;
+	return anon_read_slot (page, kva);
 }
 
-/* Swap out the page by writing contents to the swap disk. */
+/* Reads PAGE from its swap slot into KVA.
+ * Neighbouring slots of the same process within the readahead window come
+ * in with the same transfer, as long as free frames are at hand.
+ * The slot is kept, so a clean page can later be evicted without writing
+ * it again, unless swap space is running low. */
+static bool
+anon_read_slot (struct page *page, void *kva) {
+	struct anon_page *anon_page = &page->anon;
+	struct frame *staged[SWAP_BOUNCE_PAGES];
+	size_t slot = anon_page->disk_n;
+	size_t window = vm_page_advice (page) == ADV_RANDOM ? 1
+		: swap_readahead_window;
+	size_t lo = slot / window * window;
+	size_t hi = lo + window;
+	size_t first = slot, last = slot;
+
+	if (hi > bitmap_size (swap_table))
+		hi = bitmap_size (swap_table);
+	lock_acquire (&swap_lock);
+	for (size_t i = lo; i < hi; i++) {
+		staged[i - lo] = NULL;
+		if (i == slot || !swap_slot_readahead_ok (i))
+			continue;
+		if (i < first)
+			first = i;
+		if (i > last)
+			last = i;
+	}
+	lock_release (&swap_lock);
+
+	/* Readahead only uses frames that are free; it never evicts. */
+	for (size_t i = first; i <= last; i++) {
+		if (i == slot || !swap_slot_readahead_ok (i))
+			continue;
+		staged[i - lo] = vm_try_get_frame ();
+		if (staged[i - lo] == NULL) {
+			/* I - 1 would wrap around when I is 0. */
+			last = i > slot + 1 ? i - 1 : slot;
+			break;
+		}
+	}
+	swap_read_run (first, last + 1, slot, kva, staged + (first - lo));
+
+	if (swap_is_low ()) {
+		swap_slot_free (anon_page->disk_n);
+		anon_page->disk_n = -1;
+	}
+	return true;
+}
+
+/* Maps PAGE if it is sitting in a frame filled by swap readahead.
+ * Returns true if so. */
+bool
+anon_claim_staged (struct page *page) {
+	if (VM_TYPE (page->operations->type) != VM_ANON || !page->anon.staged)
+		return false;
+
+	ASSERT (page->frame != NULL);
+	if (!pml4_set_page (page->owner->pml4, page->va, page->frame->kva,
+				page->writable))
+		return false;
+	page->anon.staged = false;
+	/* Read ahead from the slot its compressed copy was written back to. */
+	if (page->anon.zswap != NULL) {
+		page->anon.disk_n = zswap_release (page->anon.zswap);
+		page->anon.zswap = NULL;
+	}
+	page->owner->swap_ra_hit++;
+	swap_ra_hit_cnt++;
+	return true;
+}
+
+/* Gives up the readahead frame of PAGE, which was never used. */
+static void
+anon_drop_staged (struct page *page) {
+	page->anon.staged = false;
+	page->owner->swap_ra_miss++;
+	swap_ra_miss_cnt++;
+}
+
+/* Tries to swap out PAGE, which needs writing, by compressing it into
+ * memory. Returns true if successful. */
+static bool
+anon_swap_out_zswap (struct page *page) {
+	struct anon_page *anon_page = &page->anon;
+	uint64_t *pml4 = page->owner->pml4;
+
+	anon_page->zswap = zswap_store (page->frame->kva, page);
+	if (anon_page->zswap == NULL)
+		return false;
+	if (anon_page->disk_n != -1) {
+		swap_slot_free (anon_page->disk_n);
+		anon_page->disk_n = -1;
+	}
+	pml4_clear_page (pml4, page->va);
+	pml4_set_dirty (pml4, page->va, false);
+	return true;
+}
+
+/* Swap out the page by writing contents to the swap disk, or to the
+ * compressed cache in front of it. */
 static bool
 anon_swap_out (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+	uint64_t *pml4 = page->owner->pml4;
+	bool dirty = pml4_is_dirty (pml4, page->va);
+
+	if (anon_page->staged) {
+		anon_drop_staged (page);
+		return true;
+	}
+	if ((dirty || anon_page->disk_n == -1) && anon_swap_out_zswap (page))
+		return true;
+
+	/* A slot shared with a forked process must not be overwritten. */
+	if (anon_page->disk_n != -1 && dirty && swap_refs[anon_page->disk_n] > 1) {
+		swap_slot_free (anon_page->disk_n);
+		anon_page->disk_n = -1;
+	}
 	if (anon_page->disk_n == -1) {
-		anon_page->disk_n = disk_cnt++;
-		for (int i = 0; i < 8; i++) {
-			disk_write(swap_disk, (anon_page->disk_n) * 8 + i, (void *) page->frame->kva + DISK_SECTOR_SIZE * i);
-		}
+		size_t slot = swap_slot_alloc (1);
+		if (slot == BITMAP_ERROR)
+			return false;
+		anon_page->disk_n = slot;
+		swap_pages[slot] = page;
+		dirty = true;
 	}
-	else if (pml4_is_dirty(thread_current()->pml4, page->va)){
-		for (int i = 0; i < 8; i++){
-			disk_write(swap_disk, (anon_page->disk_n) * 8 + i, (void *) page->frame->kva + DISK_SECTOR_SIZE * i);
+
+	pml4_clear_page (pml4, page->va);
+	if (dirty) {
+		swap_write_slot (anon_page->disk_n, page->frame->kva);
+		pml4_set_dirty (pml4, page->va, false);
+	}
+	return true;
+}
+
+/* Returns true if PAGE is an anonymous page that has to be written to
+ * swap before its frame can be reused. */
+bool
+anon_needs_writeback (struct page *page) {
+	if (VM_TYPE (page->operations->type) != VM_ANON || page->anon.staged)
+		return false;
+	return page->anon.disk_n == -1
+		|| pml4_is_dirty (page->owner->pml4, page->va);
+}
+
+/* Swaps out the CNT anonymous pages in PAGES, all of which need writing,
+ * to a run of adjacent slots with a single disk transfer. Falls back to
+ * one page at a time when swap has no free run that long. */
+bool
+anon_swap_out_cluster (struct page **pages, size_t cnt) {
+	size_t slot, i;
+
+	ASSERT (cnt <= SWAP_CLUSTER);
+
+	/* Whatever compresses well stays in memory. */
+	for (i = 0, slot = 0; i < cnt; i++)
+		if (!anon_swap_out_zswap (pages[i]))
+			pages[slot++] = pages[i];
+	cnt = slot;
+	if (cnt == 0)
+		return true;
+
+	/* Every page is rewritten anyway, so give up the old slots first. */
+	for (i = 0; i < cnt; i++) {
+		struct anon_page *anon_page = &pages[i]->anon;
+		if (anon_page->disk_n != -1) {
+			swap_slot_free (anon_page->disk_n);
+			anon_page->disk_n = -1;
 		}
 	}
-	palloc_free_page (page->frame->kva);
-	pml4_clear_page (thread_current()->pml4, page->va);
-	free (page->frame);
-	page->frame = NULL;
+
+	slot = cnt > 1 ? swap_slot_alloc (cnt) : BITMAP_ERROR;
+	if (slot == BITMAP_ERROR) {
+		for (i = 0; i < cnt; i++)
+			if (!anon_swap_out (pages[i]))
+				return false;
+		return true;
+	}
+
+	lock_acquire (&swap_bounce_lock);
+	for (i = 0; i < cnt; i++) {
+		struct page *page = pages[i];
+		pml4_clear_page (page->owner->pml4, page->va);
+		pml4_set_dirty (page->owner->pml4, page->va, false);
+		memcpy (swap_bounce + i * PGSIZE, page->frame->kva, PGSIZE);
+		page->anon.disk_n = slot + i;
+		swap_pages[slot + i] = page;
+	}
+	disk_write_multiple (swap_disk, slot * SECTORS_PER_SLOT,
+			cnt * SECTORS_PER_SLOT, swap_bounce);
+	lock_release (&swap_bounce_lock);
+	return true;
+}
+
+/* Makes PAGE, which shared its frame with FROM until FROM was swapped out
+ * through it, share the copy FROM was swapped out to. */
+void
+anon_share_swapped (struct page *page, struct page *from) {
+	struct anon_page *anon_page = &page->anon;
+
+	ASSERT (anon_page->zswap == NULL);
+	if (anon_page->disk_n != -1)
+		swap_slot_free (anon_page->disk_n);
+	anon_page->zswap = from->anon.zswap;
+	anon_page->disk_n = from->anon.disk_n;
+	if (anon_page->zswap != NULL)
+		zswap_dup (anon_page->zswap);
+	else
+		swap_slot_dup (anon_page->disk_n);
+	pml4_set_dirty (page->owner->pml4, page->va, false);
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
-	free (page->frame);
-	free (page);
+	struct anon_page *anon_page = &page->anon;
+
+	/* First, since an eviction in progress may still swap PAGE out. */
+	vm_release_frame (page);
+	if (anon_page->staged) {
+		anon_page->staged = false;
+		page->owner->swap_ra_miss++;
+		swap_ra_miss_cnt++;
+	}
+	if (anon_page->zswap != NULL) {
+		anon_page->disk_n = zswap_release (anon_page->zswap);
+		anon_page->zswap = NULL;
+	}
+	if (anon_page->disk_n != -1) {
+		swap_slot_free (anon_page->disk_n);
+		anon_page->disk_n = -1;
+	}
 }
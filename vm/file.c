@@ -14,6 +14,7 @@
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
@@ -28,14 +29,20 @@ static bool file_backed_swap_in (struct page *page, void *kva);
 static bool file_backed_swap_out (struct page *page);
 static void file_backed_destroy (struct page *page);
 
-struct lazyload {
-	struct file *file;
-	uint8_t *upage;
-	uint32_t read_bytes;
-	uint32_t zero_bytes;
-	off_t offset;
-	bool writable;
-};
+/* Number of pages brought in by one fault on a lazily loaded page,
+ * including the faulting one. Set with -fault-around=N; 1 turns it off. */
+size_t fault_around_window = 8;
+
+/* Buffer for fault-around reads. */
+static uint8_t *fault_around_buf;
+static struct lock fault_around_lock;
+
+/* Most pages of a mapping written back with one write. */
+#define WRITEBACK_MAX 32
+
+/* Buffer the dirty pages of a mapping are gathered in. */
+static uint8_t *writeback_buf;
+static struct lock writeback_lock;
 
 /* DO NOT MODIFY this struct */
 static const struct page_operations file_ops = {
@@ -48,6 +55,16 @@ static const struct page_operations file_ops = {
 /* The initializer of file vm */
 void
 vm_file_init (void) {
+	if (fault_around_buf != NULL)
+		return;
+	if (fault_around_window < 1)
+		fault_around_window = 1;
+	if (fault_around_window > FAULT_AROUND_MAX)
+		fault_around_window = FAULT_AROUND_MAX;
+	fault_around_buf = palloc_get_multiple (PAL_ASSERT, FAULT_AROUND_MAX);
+	lock_init (&fault_around_lock);
+	writeback_buf = palloc_get_multiple (PAL_ASSERT, WRITEBACK_MAX);
+	lock_init (&writeback_lock);
 }
 
 /* Initialize the file backed page */
@@ -56,160 +73,410 @@ file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
 	/* Set up the handler */
 	page->operations = &file_ops;
 	struct file_page *file_page = &page->file;
+	return true;
 }
 
 /* Swap in the page by read contents from the file. */
 static bool
 file_backed_swap_in (struct page *page, void *kva) {
 	struct file_page *file_page UNUSED = &page->file;
-	struct frame *frame = malloc(sizeof(struct frame));
-	page->frame = frame;
-	frame->page = page;
 	struct lazyload *aux = (struct lazyload *) file_page->aux;
 	file_read_at (aux->file, kva, aux->read_bytes, aux->offset);
-	pml4_set_page(thread_current()->pml4, page->va, kva, aux->writable);
-	pml4_set_dirty(thread_current()->pml4, page->va, false);
-	frame->kva = pml4_get_page(thread_current()->pml4, page->va);
+	return true;
 }
 
 /* Swap out the page by writeback contents to the file. */
 static bool
 file_backed_swap_out (struct page *page) {
 	struct file_page *file_page UNUSED = &page->file;
-	if (pml4_is_dirty(thread_current()->pml4, page->va)) {
+	uint64_t *pml4 = page->owner->pml4;
+	bool dirty = pml4_is_dirty (pml4, page->va);
+
+	pml4_clear_page (pml4, page->va);
+	if (dirty || page->frame->dirty) {
 		struct lazyload *aux = (struct lazyload *) file_page->aux;
-		file_write_at(aux->file, page->frame->kva, 0x1000, aux->offset);
+		/* The page cache may be busy, so the page stays for now. */
+		if (file_write_at (aux->file, page->frame->kva, aux->read_bytes,
+					aux->offset) != (off_t) aux->read_bytes) {
+			page->frame->dirty = true;
+			pml4_set_page (pml4, page->va, page->frame->kva, page->writable);
+			return false;
+		}
+		pml4_set_dirty (pml4, page->va, false);
+		page->frame->dirty = false;
 	}
-	palloc_free_page(page->frame->kva);
-	pml4_clear_page(thread_current()->pml4, page->va);
-	free(page->frame);
-	page->frame = NULL;
+	return true;
 }
 
 /* Destory the file backed page. PAGE will be freed by the caller. */
 static void
 file_backed_destroy (struct page *page) {
 	struct file_page *file_page UNUSED = &page->file;
-	free(page->frame);
-	free(page);
+	vm_release_frame (page);
+	free (file_page->aux);
 }
-static bool
-install_page (void *upage, void *kpage, bool writable) {
+
+/* Read-only pages of executables (IS_TEXT) are file pages that are never
+ * written back. The frame a text page is loaded into is shared with every
+ * other process that maps the same bytes of the same executable, so
+ * running a program again costs neither disk reads nor memory for text.
+ *
+ * Pages of mappings (IS_MMAP) are shared the same way, writable, so all
+ * mappers of a page of a file see each other's writes. A mapper that lets
+ * go of a frame others still map leaves its writes to them, through
+ * frame->dirty; the last one writes the frame back. */
+
+/* Maps the frame another process already loaded text or mapping page PAGE
+ * into, if there is one, instead of reading it. Returns true if so. */
+bool
+file_map_text (struct page *page) {
+	struct lazyload *aux;
+	struct frame *frame;
+
+	if (VM_TYPE (page->operations->type) == VM_UNINIT)
+		aux = page->uninit.aux;
+	else
+		aux = page->file.aux;
+	frame = vm_text_get (file_get_inode (aux->file), aux->offset,
+			aux->read_bytes, page->is_mmap, page);
+	if (frame == NULL)
+		return false;
+
+	if (!pml4_set_page (page->owner->pml4, page->va, frame->kva,
+				page->writable)) {
+		vm_release_frame (page);
+		return false;
+	}
+	if (VM_TYPE (page->operations->type) == VM_UNINIT) {
+		page->uninit.page_initializer (page, page->uninit.type, frame->kva);
+		page->file.aux = aux;
+	}
+	return true;
+}
+
+/* Lets other processes map the frame text or mapping page PAGE was just
+ * loaded into. Returns false if another frame holds the same bytes, in
+ * which case PAGE should use that one instead. */
+bool
+file_share_text (struct page *page) {
+	struct lazyload *aux = page->file.aux;
+	return vm_text_add (page->frame, file_get_inode (aux->file), aux->offset,
+			aux->read_bytes, page->is_mmap);
+}
+
+/* Maps every page of text area VMA whose frame another process already
+ * loaded, so that a program run again takes no faults on the text it
+ * shares. The other pages are left to be faulted in. */
+void
+file_map_text_area (struct supplemental_page_table *spt, struct vma *vma) {
+	struct inode *inode = file_get_inode (vma->file);
+
+	ASSERT (vma->is_text);
+	for (size_t ofs = 0; ofs < vma->read_bytes; ofs += PGSIZE) {
+		uint8_t *va = (uint8_t *) vma->start + ofs;
+		uint32_t len = vma->read_bytes - ofs < PGSIZE
+			? vma->read_bytes - ofs : PGSIZE;
+		struct page *page;
+
+		if (!vm_text_resident (inode, vma->offset + ofs, len, false))
+			continue;
+		page = vma_get_page (spt, va);
+		if (page != NULL && page->frame == NULL)
+			file_map_text (page);
+	}
+}
+
+/* Returns the page at VA if it is still uninit and would be loaded by INIT
+ * from FILE at OFFSET, so that it can come in with the same read. */
+static struct page *
+fault_around_page (void *va, vm_initializer *init, struct file *file,
+		off_t offset) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct page *page = spt_find_page (spt, va);
+	struct lazyload *aux;
+
+	/* Untouched pages of the same area are made here. */
+	if (page == NULL) {
+		struct vma *vma = vma_find (spt, va);
+		if (vma != NULL && vma->init == init && vma->file == file)
+			page = vma_get_page (spt, va);
+	}
+	if (page == NULL || VM_TYPE (page->operations->type) != VM_UNINIT
+			|| page->uninit.init != init)
+		return NULL;
+	aux = page->uninit.aux;
+	if (aux->file != file)
+		return NULL;
+	if (aux->read_bytes != 0 && aux->offset != offset)
+		return NULL;
+	return page;
+}
+
+/* Copies the data of the page described by AUX out of the fault-around
+ * buffer, which holds the file from offset START, and zeroes the rest. */
+static void
+fault_around_copy (void *kva, struct lazyload *aux, off_t start) {
+	if (aux->read_bytes != 0)
+		memcpy (kva, fault_around_buf + (aux->offset - start), aux->read_bytes);
+	memset ((uint8_t *) kva + aux->read_bytes, 0, PGSIZE - aux->read_bytes);
+}
+
+/* Makes the resident pages of the WINDOW pages below LO the first ones
+ * CLOCK evicts, since a sequential reader is done with them. */
+static void
+fault_around_deactivate (uint8_t *lo, size_t window) {
 	struct thread *t = thread_current ();
 
-	pml4_clear_page (t->pml4, upage);
+	for (size_t i = 1; i <= window; i++) {
+		struct page *page = spt_find_page (&t->spt, lo - i * PGSIZE);
+		if (page != NULL && page->frame != NULL)
+			pml4_set_accessed (t->pml4, page->va, false);
+	}
+}
+
+/* Loads PAGE, whose data is described by AUX, into its frame. Neighbouring
+ * pages within the aligned fault-around window that INIT would load from the
+ * next bytes of the same file come in with the same read and are mapped
+ * right away, as long as there are free frames for them. Bytes past the end
+ * of the file read as zeroes. The window is the largest for areas advised
+ * sequential and a single page for ones advised random.
+ * PAGE has already been transmuted, so INIT is passed in. */
+bool
+lazyload_around (struct page *page, struct lazyload *aux,
+		vm_initializer *init) {
+	struct page *run[FAULT_AROUND_MAX];
+	struct frame *frames[FAULT_AROUND_MAX];
+	enum vm_advice advice = vm_page_advice (page);
+	size_t window = advice == ADV_SEQUENTIAL ? FAULT_AROUND_MAX
+		: advice == ADV_RANDOM ? 1 : fault_around_window;
+	size_t idx = pg_no (page->va) % window;
+	uint8_t *lo = (uint8_t *) page->va - idx * PGSIZE;
+	size_t first = idx, last = idx, i;
+	off_t start, end, got;
+
+	if (advice == ADV_SEQUENTIAL)
+		fault_around_deactivate (lo, window);
 
-	return (pml4_get_page (t->pml4, upage) == NULL
-			&& pml4_set_page (t->pml4, upage, kpage, writable));
+	/* Find the run of pages around PAGE that continue it in the file. */
+	while (first > 0) {
+		off_t ofs = aux->offset - (off_t) (idx - first + 1) * PGSIZE;
+		run[first - 1] = fault_around_page (lo + (first - 1) * PGSIZE, init,
+				aux->file, ofs);
+		if (run[first - 1] == NULL)
+			break;
+		first--;
+	}
+	while (last + 1 < window) {
+		off_t ofs = aux->offset + (off_t) (last + 1 - idx) * PGSIZE;
+		run[last + 1] = fault_around_page (lo + (last + 1) * PGSIZE, init,
+				aux->file, ofs);
+		if (run[last + 1] == NULL)
+			break;
+		last++;
+	}
+
+	/* Fault-around only uses frames that are free; it never evicts. */
+	for (i = idx + 1; i <= last; i++)
+		if ((frames[i] = vm_try_get_frame ()) == NULL) {
+			last = i - 1;
+			break;
+		}
+	for (i = idx; i > first; i--)
+		if ((frames[i - 1] = vm_try_get_frame ()) == NULL) {
+			first = i;
+			break;
+		}
+
+	if (first == last) {
+		got = file_read_at (aux->file, page->frame->kva, aux->read_bytes,
+				aux->offset);
+		memset ((uint8_t *) page->frame->kva + got, 0, PGSIZE - got);
+		return true;
+	}
+
+	start = aux->offset - (off_t) (idx - first) * PGSIZE;
+	end = start;
+	for (i = first; i <= last; i++) {
+		struct lazyload *naux = i == idx ? aux : run[i]->uninit.aux;
+		if (naux->read_bytes != 0)
+			end = naux->offset + naux->read_bytes;
+	}
+
+	lock_acquire (&fault_around_lock);
+	got = file_read_at (aux->file, fault_around_buf, end - start, start);
+	memset (fault_around_buf + got, 0, end - start - got);
+	fault_around_copy (page->frame->kva, aux, start);
+	for (i = first; i <= last; i++) {
+		struct page *n = run[i];
+		struct lazyload *naux;
+		if (i == idx)
+			continue;
+		naux = n->uninit.aux;
+		fault_around_copy (frames[i]->kva, naux, start);
+		if (!pml4_set_page (n->owner->pml4, n->va, frames[i]->kva,
+					n->writable)) {
+			vm_free_frame (frames[i]);
+			continue;
+		}
+		n->uninit.page_initializer (n, n->uninit.type, frames[i]->kva);
+		if (VM_TYPE (n->operations->type) == VM_FILE)
+			n->file.aux = naux;
+		else
+			free (naux);
+		vm_frame_link (frames[i], n);
+		frames[i]->pinned = false;
+		/* Someone else has it already; N faults that frame in later. */
+		if ((n->is_text || n->is_mmap) && !file_share_text (n))
+			vm_release_frame (n);
+	}
+	lock_release (&fault_around_lock);
+	return true;
 }
+
 static bool
 lazyload_file (struct page *page, void *aux) {
 	struct file_page *file_page UNUSED = &page->file;
-	struct lazyload * aux1 = (struct lazyload *) aux;
-	file_seek (aux1->file, aux1->offset); 
-	uint8_t *kpage = page->frame->kva;
-	file_read (aux1->file, kpage, aux1->read_bytes);
-	if (!install_page (aux1->upage, kpage, aux1->writable)) {
-		palloc_free_page (kpage);
-		return false;
-	}
-	page->frame->kva = pml4_get_page(thread_current()->pml4, page->va);
-	pml4_set_dirty(thread_current()->pml4, page->va, false);
 	file_page->aux = aux;
-	return true;
+	return lazyload_around (page, aux, lazyload_file);
 }
 
 /* Do the mmap */
 void *
 do_mmap (void *addr, size_t length, int writable,
 		struct file *file, off_t offset) {
-	void *taddr = addr;
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct vma *vma;
+	off_t file_len;
+	size_t read_bytes;
+
 	if (addr == 0 || (addr+length) == 0 || is_kernel_vaddr(addr) || is_kernel_vaddr(addr+length)
 		|| length == 0 || offset % 0x1000 != 0) return NULL;
-	struct page *page = spt_find_page(&thread_current()->spt, addr);
-	if(page != NULL && VM_TYPE(page -> operations -> type) == VM_ANON) return NULL;
-	struct list_elem *e;
-	struct mm_file* mm;
-	for (e = list_begin (&(thread_current()->mmfile_list)); e != list_end (&(thread_current()->mmfile_list)); e = list_next (e)) {
-		mm = list_entry (e, struct mm_file, elem);
-		if(mm->addr == addr){
-			return NULL; 
+	/* Only the part within the file is read and written back; the rest
+	 * of the mapping is zeroes that never reach the file. */
+	file_len = file_length (file);
+	read_bytes = file_len > offset ? (size_t) (file_len - offset) : 0;
+	if (read_bytes > length)
+		read_bytes = length;
+	/* Fails if the range overlaps another area or the stack. */
+	vma = vma_add (spt, addr, length, VM_FILE, lazyload_file, file, offset,
+			read_bytes, writable);
+	if (vma == NULL)
+		return NULL;
+	vma->is_mmap = true;
+	return addr;
+}
+
+/* Returns the page of a mapping at VA if it is resident and dirty. */
+static struct page *
+writeback_page (struct supplemental_page_table *spt, void *va) {
+	struct page *page = spt_find_page (spt, va);
+
+	if (page == NULL || page->frame == NULL
+			|| VM_TYPE (page->operations->type) != VM_FILE
+			|| (!page->frame->dirty && !pml4_is_dirty (page->owner->pml4, va)))
+		return NULL;
+	return page;
+}
+
+/* Writes back the dirty pages of mapping VMA in [LO, HI). Each run of
+ * dirty pages, up to WRITEBACK_MAX of them, is gathered from the frames
+ * and written with one file_write_at(). */
+static void
+mmap_writeback (struct supplemental_page_table *spt, struct vma *vma,
+		uint8_t *lo, uint8_t *hi) {
+	uint8_t *va = lo;
+
+	lock_acquire (&writeback_lock);
+	while (va < hi) {
+		struct page *page = writeback_page (spt, va);
+		struct lazyload *aux;
+		off_t start, len = 0;
+		size_t n = 0;
+
+		if (page == NULL) {
+			va += PGSIZE;
+			continue;
 		}
+		start = ((struct lazyload *) page->file.aux)->offset;
+		do {
+			/* Pinned, so that it is not evicted during the copy. */
+			struct frame *frame = vm_frame_pin (page);
+
+			aux = page->file.aux;
+			/* Evicted meanwhile, which wrote it back. */
+			if (frame == NULL)
+				break;
+			/* Clear first, so a write during the copy makes it dirty
+			 * again. */
+			pml4_set_dirty (page->owner->pml4, va, false);
+			frame->dirty = false;
+			memcpy (writeback_buf + n * PGSIZE, frame->kva, aux->read_bytes);
+			vm_frame_unpin (frame);
+			len += aux->read_bytes;
+			n++;
+			va += PGSIZE;
+		} while (n < WRITEBACK_MAX && aux->read_bytes == PGSIZE && va < hi
+				&& (page = writeback_page (spt, va)) != NULL);
+		if (n > 0)
+			file_write_at (vma->file, writeback_buf, len, start);
 	}
-	struct mm_file* mfile = malloc(sizeof(struct mm_file));
-	mfile->addr = addr;
-	list_init (&(mfile->page_list));
-	int length_tmp = length;
-	off_t offset_check = -1;
-	if (offset == 0) offset_check = 0;
-	while (length_tmp) {
-		void *aux = NULL;
-		struct lazyload *aux1 = (struct lazyload *)malloc(sizeof(struct lazyload));
-		struct page_addr* paddr = malloc(sizeof(struct page_addr));
-		aux1->file = (uint64_t)file;
-		aux1->upage = addr;
-		paddr->file = file;
-		paddr->addr = addr;
-		if (length_tmp < 0x1000){
-			paddr->size = length_tmp;
-			aux1->read_bytes = length_tmp;
-			aux1->zero_bytes = 0x1000 - length_tmp;
-		}
-		else {
-			paddr->size = 0x1000;
-			aux1->read_bytes = 0x1000;
-			aux1->zero_bytes = 0;
-		}
-		aux1->writable = writable;
-		if (offset_check == -1){
-			aux1->offset = offset;
-			paddr->offset = offset;
-		}
-		else{
-			aux1->offset = offset_check;
-			paddr->offset = offset_check;
-			offset_check += 0x1000;
-		}
-		aux = aux1;
-		if (!vm_alloc_page_with_initializer (VM_FILE, addr, writable, lazyload_file, aux))
-			return false;
-		length_tmp -= 0x1000;
-		addr += 0x1000;
-		list_push_back (&(mfile->page_list), &(paddr->elem));
+	lock_release (&writeback_lock);
+}
+
+/* Writes back the dirty pages of mapping VMA and unmaps it. Frames other
+ * processes still map are left for the last of them to write back. */
+static void
+munmap_vma (struct supplemental_page_table *spt, struct vma *vma) {
+	for (uint8_t *va = vma->start; va < (uint8_t *) vma->end; va += PGSIZE) {
+		struct page *page = spt_find_page (spt, va);
+		if (page != NULL)
+			vm_release_shared_frame (page);
 	}
-	list_push_back (&(thread_current()->mmfile_list), &(mfile->elem));
-	return taddr;
+	mmap_writeback (spt, vma, vma->start, vma->end);
+	vma_remove (spt, vma);
 }
 
 /* Do the munmap */
 void
 do_munmap (void *addr) {
-	struct list_elem *e;
-	struct mm_file* mm;
-	struct mm_file* mm_free = NULL;
-	for (e = list_begin (&(thread_current()->mmfile_list)); e != list_end (&(thread_current()->mmfile_list)); e = list_next (e)) {
-		mm = list_entry (e, struct mm_file, elem);
-		if (mm->addr == addr){
-			mm_free = mm;
-			break;
-		}
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct vma *vma = vma_find (spt, addr);
+
+	if (vma == NULL || vma->start != addr || !vma->is_mmap)
+		return;
+	munmap_vma (spt, vma);
+}
+
+/* Writes back the dirty pages of the mappings in the LENGTH bytes at
+ * ADDR, which must be page-aligned and mapped. Returns false if not. */
+bool
+do_msync (void *addr, size_t length) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	uint8_t *lo = addr, *hi = lo + ROUND_UP (length, PGSIZE);
+
+	if (!vma_covers (spt, addr, length, true))
+		return false;
+	for (uint8_t *va = lo; va < hi;) {
+		struct vma *vma = vma_find (spt, va);
+		uint8_t *end = (uint8_t *) vma->end < hi ? vma->end : hi;
+		mmap_writeback (spt, vma, va, end);
+		va = end;
 	}
-	if (mm_free == NULL) return;
-	list_remove(e);
-	struct page_addr* paddr;
-	for (e = list_begin (&(mm_free->page_list)); e != list_end (&(mm_free->page_list));) {
-		struct page *page = NULL;
-		paddr = list_entry (e, struct page_addr, elem);
-		page = spt_find_page(&thread_current()->spt, paddr->addr);
+	return true;
+}
+
+/* Unmaps every mapping of the current process, on exit. */
+void
+do_munmap_all (void) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct list_elem *e;
+
+	if (spt->hash_table == NULL)
+		return;
+	for (e = list_begin (&spt->vma_list); e != list_end (&spt->vma_list);) {
+		struct vma *vma = list_entry (e, struct vma, elem);
 		e = list_next (e);
-		if(page != NULL) {
-			if (pml4_is_dirty(thread_current()->pml4, page->va)){
-				file_write_at(paddr -> file, paddr -> addr, paddr -> size, paddr -> offset);
-			}
-			hash_delete(thread_current()->spt.hash_table, &(page->elem));
-			free(paddr);
-		}
+		if (vma->is_mmap)
+			munmap_vma (spt, vma);
 	}
-	free(mm_free);
-	return;
 }
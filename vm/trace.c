@@ -0,0 +1,165 @@
+/* trace.c: Page fault trace and statistics.
+ *
+ * With -fault-trace=N, the last N page faults and evictions are kept in
+ * a ring buffer and saved to FAULT_TRACE_FILE after each `run' action,
+ * from where `get' copies them out. utils/fault-replay replays them
+ * against other replacement policies.
+ *
+ * Every fault, and every eviction a fault waits for, is also counted by
+ * type with the TSC cycles it took, per process and system-wide, and
+ * system-wide in a log2 histogram. fault_stats() reads them, and they
+ * are printed at shutdown. */
+
+#include "vm/trace.h"
+#include "devices/timer.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/anon.h"
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Records to keep; 0 turns tracing off. Set with -fault-trace=N. The
+ * default scratch disk holds at most FAULT_TRACE_MAX of them. */
+size_t fault_trace_size;
+#define FAULT_TRACE_MAX 65000
+
+struct fault_trace_hdr {
+	char magic[4];
+	uint32_t cnt;
+	uint32_t lost;
+};
+
+static struct fault_rec *ring;
+static uint64_t ring_next;        /* Records ever added. */
+
+/* Allocates the ring buffer, if tracing is on. */
+void
+fault_trace_init (void) {
+	if (fault_trace_size == 0)
+		return;
+	if (fault_trace_size > FAULT_TRACE_MAX)
+		fault_trace_size = FAULT_TRACE_MAX;
+	ring = palloc_get_multiple (PAL_ASSERT,
+			DIV_ROUND_UP (fault_trace_size * sizeof *ring, PGSIZE));
+}
+
+/* Records a fault of TYPE at VA by thread TID. */
+void
+fault_trace_add (const void *va, int tid, bool write, enum fault_type type) {
+	enum intr_level old_level;
+	struct fault_rec *r;
+
+	if (ring == NULL)
+		return;
+	old_level = intr_disable ();
+	r = &ring[ring_next++ % fault_trace_size];
+	r->va = (uint64_t) pg_round_down (va);
+	r->tick = timer_ticks ();
+	r->tid = tid;
+	r->write = write;
+	r->type = type;
+	intr_set_level (old_level);
+}
+
+/* Writes the records in the ring, oldest first, to FAULT_TRACE_FILE. */
+void
+fault_trace_save (void) {
+	struct fault_trace_hdr hdr;
+	struct file *file;
+	size_t cnt, first;
+
+	if (ring == NULL)
+		return;
+	cnt = ring_next < fault_trace_size ? ring_next : fault_trace_size;
+	first = ring_next % fault_trace_size;
+	if (cnt < fault_trace_size)
+		first = 0;
+	memcpy (hdr.magic, "FTRC", 4);
+	hdr.cnt = cnt;
+	hdr.lost = ring_next - cnt;
+
+	printf ("Saving %zu page faults to '%s'...\n", cnt, FAULT_TRACE_FILE);
+	filesys_remove (FAULT_TRACE_FILE);
+	if (!filesys_create (FAULT_TRACE_FILE, sizeof hdr + cnt * sizeof *ring)
+			|| (file = filesys_open (FAULT_TRACE_FILE)) == NULL) {
+		printf ("%s: create failed\n", FAULT_TRACE_FILE);
+		return;
+	}
+	file_write (file, &hdr, sizeof hdr);
+	file_write (file, ring + first, (cnt - first) * sizeof *ring);
+	file_write (file, ring, first * sizeof *ring);
+	file_close (file);
+}
+
+static const char *fault_type_names[FT_CNT] = {
+	"load", "zero", "swap", "staged", "wp", "stack", "evict",
+};
+
+/* System-wide counters. */
+static struct fault_stats fault_stats;
+
+/* Counts an event of TYPE that took CYCLES, for the current thread. */
+void
+fault_stat_add (enum fault_type type, uint64_t cycles) {
+	struct thread *t = thread_current ();
+	enum intr_level old_level;
+	int bucket = 0;
+
+	ASSERT (type < FT_CNT);
+	while (bucket < FAULT_HIST_BUCKETS - 1 && cycles >> (bucket + 1) != 0)
+		bucket++;
+	old_level = intr_disable ();
+	fault_stats.cnt[type]++;
+	fault_stats.cycles[type] += cycles;
+	fault_stats.hist[type][bucket]++;
+	t->fault_cnt[type]++;
+	t->fault_cycles[type] += cycles;
+	intr_set_level (old_level);
+}
+
+/* Copies the system-wide counters to ST if ALL, or else those of the
+ * current thread, which have no histogram, along with the swap readahead
+ * hits and misses. ST may be in user memory, so interrupts stay on and
+ * the copy may be slightly torn. */
+void
+fault_stat_get (struct fault_stats *st, bool all) {
+	struct thread *t = thread_current ();
+
+	if (all) {
+		memcpy (st, &fault_stats, sizeof *st);
+		swap_ra_stats (&st->swap_ra_hit, &st->swap_ra_miss);
+		return;
+	}
+	memset (st, 0, sizeof *st);
+	for (int i = 0; i < FT_CNT; i++) {
+		st->cnt[i] = t->fault_cnt[i];
+		st->cycles[i] = t->fault_cycles[i];
+	}
+	st->swap_ra_hit = t->swap_ra_hit;
+	st->swap_ra_miss = t->swap_ra_miss;
+}
+
+/* Prints the system-wide counters, with the median of each type taken
+ * from its histogram. */
+void
+fault_stat_print (void) {
+	for (int i = 0; i < FT_CNT; i++) {
+		uint64_t cnt = fault_stats.cnt[i], seen = 0;
+		int median = 0;
+
+		if (cnt == 0)
+			continue;
+		while (median < FAULT_HIST_BUCKETS - 1
+				&& (seen += fault_stats.hist[i][median]) * 2 < cnt)
+			median++;
+		printf ("Faults: %llu %s, %llu cycles average, median under %llu\n",
+				(unsigned long long) cnt, fault_type_names[i],
+				(unsigned long long) (fault_stats.cycles[i] / cnt),
+				1ULL << (median + 1));
+	}
+}
@@ -3,9 +3,17 @@
 #include "threads/malloc.h"
 #include "vm/vm.h"
 #include "vm/inspect.h"
+#include "vm/trace.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/mmu.h"
+#include "intrinsic.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
+#include "threads/synch.h"
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
 
 bool compare_hash (const struct hash_elem *a, const struct hash_elem *b, void *aux);
 unsigned apply_hash (const struct hash_elem *e, void *aux);
@@ -15,6 +23,66 @@ unsigned apply_hash (const struct hash_elem *e, void *aux);
  
 const void* stack_limit = (void *) (((uint8_t *) USER_STACK) - 256*PGSIZE);
 
+/* Frame table. One entry per user pool page, indexed by physical frame
+ * number, so claiming a frame never allocates. CLOCK_HAND sweeps the whole
+ * table, whichever process owns each frame. */
+static struct frame *frame_table;
+static size_t frame_cnt;
+static void *frame_base;
+static size_t clock_hand;
+static struct lock frame_lock;
+
+/* Signalled, with FRAME_LOCK, whenever frames are done being evicted. */
+static struct condition evict_cond;
+
+/* Frames holding read-only executable pages that every process running
+ * the executable maps, keyed by the bytes of the file they were loaded
+ * from. Protected by FRAME_LOCK. */
+static struct hash text_table;
+static uint64_t text_hash (const struct hash_elem *e, void *aux);
+static bool text_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux);
+static void vm_text_remove (struct frame *frame);
+
+/* Frame of zeroes that read faults on untouched anonymous pages map
+ * read-only. It holds a share of its own so it is never freed, and has no
+ * page so it is never evicted. */
+static struct frame *zero_frame;
+
+/* Resident set limit, in frames, of processes that do not set their own
+ * with set_rss_limit(); 0 for none. Set with -rss-limit=N. */
+size_t vm_rss_limit;
+
+/* Whether faults may map 2 MiB at once, see vm_map_large(). Turned off
+ * with -no-large-pages. */
+bool vm_large_pages = true;
+static long long large_cnt;       /* Large pages mapped. */
+
+/* Background reclaim: once fewer than RECLAIM_LOW_WMARK user frames are
+ * free, the reclaim thread evicts until RECLAIM_HIGH_WMARK are. Set with
+ * -reclaim-low=N and -reclaim-high=N; a low watermark of 0 turns it off. */
+size_t reclaim_low_wmark = SIZE_MAX;
+size_t reclaim_high_wmark = SIZE_MAX;
+static struct semaphore reclaim_sema;
+static bool reclaim_busy;         /* Woken and not yet done. */
+static long long reclaim_cnt;     /* Frames freed by the reclaim thread. */
+static long long direct_evict_cnt;  /* Evictions in faulting threads. */
+static long long local_evict_cnt;   /* Evictions by processes at their limit. */
+static void reclaim_daemon (void *aux);
+static void vm_reclaim_kick (void);
+
+/* Same-page merging: with -merge=N, the merge thread looks at N frames
+ * every MERGE_INTERVAL ticks and maps anonymous pages with the same
+ * contents to one read-only frame, see merge_scan_frame(). */
+#define MERGE_INTERVAL (TIMER_FREQ / 10)
+size_t merge_scan_cnt;
+static size_t merge_hand;
+static long long merge_scanned_cnt;   /* Anonymous pages looked at. */
+static long long merge_cnt;           /* Pages merged into another's frame. */
+static long long merge_zero_cnt;      /* Pages merged into the zero frame. */
+static long long unmerge_cnt;         /* Merged pages copied by writes. */
+static void merge_daemon (void *aux);
+
 void
 vm_init (void) {
 	vm_anon_init ();
@@ -25,6 +93,25 @@ vm_init (void) {
 	register_inspect_intr ();
 	/* DO NOT MODIFY UPPER LINES. */
 	/* TODO: Your code goes here. */
+#ifndef EFILESYS
+	pagecache_init ();
+#endif
+	hash_init (&text_table, text_hash, text_less, NULL);
+	fault_trace_init ();
+	if (reclaim_low_wmark == SIZE_MAX)
+		reclaim_low_wmark = frame_cnt / 64;
+	if (reclaim_high_wmark == SIZE_MAX)
+		reclaim_high_wmark = reclaim_low_wmark * 2;
+	if (reclaim_high_wmark < reclaim_low_wmark)
+		reclaim_high_wmark = reclaim_low_wmark;
+	sema_init (&reclaim_sema, 0);
+
+	zero_frame = vm_get_frame ();
+	zero_frame->pinned = false;
+	if (reclaim_low_wmark > 0)
+		thread_create ("reclaimd", PRI_DEFAULT, reclaim_daemon, NULL);
+	if (merge_scan_cnt > 0)
+		thread_create ("merged", PRI_DEFAULT, merge_daemon, NULL);
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -41,10 +128,42 @@ page_get_type (struct page *page) {
 	}
 }
 
+/* Builds the frame table for the user pool of PAGE_CNT pages starting at
+ * BASE. Called by palloc_init, before anything is handed out of the pool. */
+void
+vm_frame_table_init (void *base, size_t page_cnt) {
+	size_t table_pages = DIV_ROUND_UP (page_cnt * sizeof (struct frame), PGSIZE);
+
+	frame_table = palloc_get_multiple (PAL_ASSERT | PAL_ZERO, table_pages);
+	frame_base = base;
+	frame_cnt = page_cnt;
+	clock_hand = 0;
+	lock_init (&frame_lock);
+	cond_init (&evict_cond);
+	for (size_t i = 0; i < page_cnt; i++) {
+		frame_table[i].kva = (uint8_t *) base + i * PGSIZE;
+		list_init (&frame_table[i].pages);
+	}
+}
+
+/* Returns the frame table entry of the user pool page at KVA. */
+struct frame *
+vm_frame_lookup (void *kva) {
+	size_t idx = pg_no (kva) - pg_no (frame_base);
+
+	ASSERT (idx < frame_cnt);
+	return &frame_table[idx];
+}
+
 /* Helpers */
-static struct frame *vm_get_victim (void);
+static struct frame *vm_get_victim (bool clean_only, struct thread *owner);
 static bool vm_do_claim_page (struct page *page);
-static struct frame *vm_evict_frame (void);
+static bool vm_map_zero (struct page *page);
+static bool vm_map_large (struct supplemental_page_table *spt, void *addr,
+		bool write);
+static struct frame *vm_evict_frame (bool clean_only,
+		struct thread *owner);
+static void vm_frame_put (struct frame *frame, struct page *page);
 
 /* Create the pending page object with initializer. If you want to create a
  * page, do not create it directly and make it through this function or
@@ -61,12 +180,17 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 		 * TODO: and then create "uninit" page struct by calling uninit_new. You
 		 * TODO: should modify the field after calling the uninit_new. */
 		struct page *page = malloc(sizeof(struct page));
+		if (page == NULL)
+			goto err;
 		if(VM_TYPE(type) == VM_ANON) uninit_new(page, upage, init, type, aux, anon_initializer);
 		else if(VM_TYPE(type) == VM_FILE) uninit_new(page, upage, init, type, aux, file_backed_initializer);
 
 		/* TODO: Insert the page into the spt. */
+		page->owner = thread_current ();
 		page->writable = writable;
-		page->evict_cnt = 0;
+		page->is_stack = false;
+		page->is_text = false;
+		page->is_mmap = false;
 		if(spt_insert_page(spt, page)) printf("vm_alloc_page error\n");
 	}
 	return true;
@@ -95,143 +219,1287 @@ spt_insert_page (struct supplemental_page_table *spt UNUSED,
 
 void
 spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
+	hash_delete (spt->hash_table, &page->elem);
 	vm_dealloc_page (page);
+}
+
+/* Maps LENGTH bytes at START, which must be page-aligned, as an area of
+ * pages of TYPE that INIT loads from FILE. Pages within READ_BYTES of
+ * START get their contents from FILE at OFFSET onwards, the rest are
+ * zeroes. No struct page is made until a page is touched.
+ * Returns the new area, or NULL if it overlaps another area or the stack
+ * or memory is short. */
+struct vma *
+vma_add (struct supplemental_page_table *spt, void *start, size_t length,
+		enum vm_type type, vm_initializer *init, struct file *file,
+		off_t offset, size_t read_bytes, bool writable) {
+	uint8_t *end = (uint8_t *) start + ROUND_UP (length, PGSIZE);
+	struct list_elem *e;
+	struct vma *vma;
+
+	ASSERT (pg_ofs (start) == 0);
+	if (length == 0 || end < (uint8_t *) start || !is_user_vaddr (end - 1))
+		return NULL;
+	if (end > (uint8_t *) spt->stack_bottom && (uint8_t *) start < (uint8_t *) USER_STACK)
+		return NULL;
+	for (e = list_begin (&spt->vma_list); e != list_end (&spt->vma_list);
+			e = list_next (e)) {
+		struct vma *next = list_entry (e, struct vma, elem);
+		if ((uint8_t *) next->start >= end)
+			break;
+		if ((uint8_t *) next->end > (uint8_t *) start)
+			return NULL;
+	}
+
+	vma = malloc (sizeof *vma);
+	if (vma == NULL)
+		return NULL;
+	*vma = (struct vma) {
+		.start = start,
+		.end = end,
+		.type = type,
+		.init = init,
+		.file = file,
+		.offset = offset,
+		.read_bytes = read_bytes,
+		.writable = writable,
+	};
+	list_insert (e, &vma->elem);
+	return vma;
+}
+
+/* Returns the area that VA lies in, or NULL. */
+struct vma *
+vma_find (struct supplemental_page_table *spt, const void *va) {
+	struct list_elem *e;
+
+	for (e = list_begin (&spt->vma_list); e != list_end (&spt->vma_list);
+			e = list_next (e)) {
+		struct vma *vma = list_entry (e, struct vma, elem);
+		if (va < vma->start)
+			break;
+		if (va < vma->end)
+			return vma;
+	}
+	return NULL;
+}
+
+/* Unmaps VMA, destroying whatever pages of it were touched. */
+void
+vma_remove (struct supplemental_page_table *spt, struct vma *vma) {
+	for (uint8_t *va = vma->start; va < (uint8_t *) vma->end; va += PGSIZE) {
+		struct page *page = spt_find_page (spt, va);
+		if (page != NULL)
+			spt_remove_page (spt, page);
+	}
+	list_remove (&vma->elem);
+	free (vma);
+}
+
+/* Returns the page at VA, making it from the area VA lies in if it has
+ * not been touched yet. Returns NULL if VA is not mapped. */
+struct page *
+vma_get_page (struct supplemental_page_table *spt, void *va) {
+	struct page *page = spt_find_page (spt, va);
+	struct vma *vma;
+	struct lazyload *aux;
+	size_t ofs;
+	uint32_t read_bytes;
+
+	if (page != NULL || (vma = vma_find (spt, va)) == NULL)
+		return page;
+
+	va = pg_round_down (va);
+	ofs = (uint8_t *) va - (uint8_t *) vma->start;
+	read_bytes = 0;
+	if (vma->read_bytes > ofs)
+		read_bytes = vma->read_bytes - ofs < PGSIZE ? vma->read_bytes - ofs
+			: PGSIZE;
+
+	/* Pure bss pages need no loading; see vm_map_zero(). */
+	if (read_bytes == 0 && vma->type == VM_ANON) {
+		if (!vm_alloc_page (VM_ANON, va, vma->writable))
+			return NULL;
+		return spt_find_page (spt, va);
+	}
+
+	aux = malloc (sizeof *aux);
+	if (aux == NULL)
+		return NULL;
+	*aux = (struct lazyload) {
+		.file = vma->file,
+		.upage = va,
+		.read_bytes = read_bytes,
+		.zero_bytes = PGSIZE - read_bytes,
+		.offset = vma->offset + ofs,
+		.writable = vma->writable,
+	};
+	if (!vm_alloc_page_with_initializer (vma->type, va, vma->writable,
+				vma->init, aux)) {
+		free (aux);
+		return NULL;
+	}
+	page = spt_find_page (spt, va);
+	page->is_text = vma->is_text;
+	page->is_mmap = vma->is_mmap;
+	return page;
+}
+
+/* Returns true if the LENGTH bytes at ADDR are page-aligned and every
+ * page of them is in an area, made by mmap() if MMAP_ONLY. */
+bool
+vma_covers (struct supplemental_page_table *spt, void *addr, size_t length,
+		bool mmap_only) {
+	uint8_t *lo = addr, *hi = lo + ROUND_UP (length, PGSIZE);
+	struct vma *vma;
+
+	if (pg_ofs (addr) != 0 || hi < lo || !is_user_vaddr (hi - 1))
+		return false;
+	for (uint8_t *va = lo; va < hi; va = vma->end) {
+		vma = vma_find (spt, va);
+		if (vma == NULL || (mmap_only && !vma->is_mmap))
+			return false;
+	}
+	return true;
+}
+
+/* Returns the advice given for the area PAGE is in. */
+enum vm_advice
+vm_page_advice (struct page *page) {
+	struct vma *vma = vma_find (&page->owner->spt, page->va);
+	return vma != NULL ? vma->advice : ADV_NORMAL;
+}
+
+/* Acts on ADVICE for the LENGTH bytes at ADDR, which must be page-aligned
+ * and mapped. ADV_WILLNEED loads the pages that were touched before but
+ * are not resident, while frames are free; untouched pages are left to
+ * fault-around, so that no struct page is made for them. ADV_DONTNEED
+ * drops the pages, writing back mappings, so that they are made again on
+ * the next touch. The other advice sticks to the whole of each area in
+ * the range. Returns false if ADVICE is unknown or the range is not
+ * mapped. */
+bool
+vm_madvise (void *addr, size_t length, enum vm_advice advice) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	uint8_t *lo = addr, *hi = lo + ROUND_UP (length, PGSIZE);
+
+	if ((unsigned) advice > ADV_DONTNEED
+			|| !vma_covers (spt, addr, length, false))
+		return false;
+	for (uint8_t *va = lo; va < hi; va += PGSIZE) {
+		struct vma *vma = vma_find (spt, va);
+		struct page *page;
+
+		switch (advice) {
+			case ADV_NORMAL:
+			case ADV_RANDOM:
+			case ADV_SEQUENTIAL:
+				vma->advice = advice;
+				va = (uint8_t *) vma->end - PGSIZE;
+				break;
+			case ADV_WILLNEED:
+				if (palloc_user_free_cnt () <= reclaim_low_wmark)
+					return true;
+				page = spt_find_page (spt, va);
+				/* Untouched bss would only be zeroes. */
+				if (page != NULL && page->frame == NULL
+						&& (VM_TYPE (page->operations->type) != VM_UNINIT
+							|| page->uninit.init != NULL))
+					vm_do_claim_page (page);
+				break;
+			case ADV_DONTNEED:
+				if (vma->is_mmap)
+					do_msync (va, PGSIZE);
+				page = spt_find_page (spt, va);
+				if (page != NULL)
+					spt_remove_page (spt, page);
+				break;
+		}
+	}
+	return true;
+}
+
+/* Returns true if PAGE can be evicted without writing it anywhere. */
+static bool
+vm_page_is_clean (struct page *page) {
+	if (VM_TYPE (page->operations->type) == VM_ANON)
+		return !anon_needs_writeback (page);
+	if (page->owner == NULL)
+		return !page->page_cache.dirty;
+	return !page->frame->dirty && !pml4_is_dirty (page->owner->pml4, page->va);
+}
+
+/* Returns whether PAGE was accessed since the last call, and clears that.
+ * Page cache pages belong to no process and keep the bit themselves. */
+static bool
+vm_page_test_accessed (struct page *page) {
+	bool accessed;
+
+	if (page->owner == NULL) {
+		accessed = page->page_cache.accessed;
+		page->page_cache.accessed = false;
+	} else {
+		accessed = pml4_is_accessed (page->owner->pml4, page->va);
+		if (accessed)
+			pml4_set_accessed (page->owner->pml4, page->va, false);
+	}
+	return accessed;
+}
+
+/* Returns whether any page mapping FRAME was accessed since the last
+ * call, and clears that for all of them. */
+static bool
+vm_frame_test_accessed (struct frame *frame) {
+	bool accessed = false;
+
+	for (struct list_elem *e = list_begin (&frame->pages);
+			e != list_end (&frame->pages); e = list_next (e))
+		if (vm_page_test_accessed (list_entry (e, struct page, frame_elem)))
+			accessed = true;
+	return accessed;
+}
+
+/* Returns true if FRAME can be evicted without writing it anywhere. Any
+ * of the pages sharing a file page's frame may have written it; the
+ * pages sharing an anonymous frame are all read-only. */
+static bool
+vm_frame_is_clean (struct frame *frame) {
+	if (!vm_page_is_clean (frame->page))
+		return false;
+	if (VM_TYPE (frame->page->operations->type) != VM_FILE)
+		return true;
+	for (struct list_elem *e = list_begin (&frame->pages);
+			e != list_end (&frame->pages); e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		if (pml4_is_dirty (page->owner->pml4, page->va))
+			return false;
+	}
 	return true;
 }
 
-/* Get the struct frame, that will be evicted. */
+/* Unmaps the pages other than FRAME->page that share FRAME, which is
+ * about to be evicted through FRAME->page, keeping what they wrote in
+ * FRAME->dirty. */
+static void
+vm_frame_detach_sharers (struct frame *frame) {
+	for (struct list_elem *e = list_begin (&frame->pages);
+			e != list_end (&frame->pages); e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		uint64_t *pml4 = page->owner->pml4;
+
+		if (page == frame->page)
+			continue;
+		if (pml4_is_dirty (pml4, page->va))
+			frame->dirty = true;
+		pml4_clear_page (pml4, page->va);
+	}
+}
+
+/* Maps FRAME again for the pages vm_frame_detach_sharers() unmapped, if
+ * it could not be evicted after all. Anonymous pages that share a frame
+ * are read-only until they copy it. */
+static void
+vm_frame_reattach_sharers (struct frame *frame) {
+	for (struct list_elem *e = list_begin (&frame->pages);
+			e != list_end (&frame->pages); e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+
+		if (page != frame->page)
+			pml4_set_page (page->owner->pml4, page->va, frame->kva,
+					page->is_mmap && page->writable);
+	}
+}
+
+/* Lets go of FRAME, just evicted through FRAME->page, for every page that
+ * mapped it. The other pages of a file read it back from the file;
+ * anonymous ones share the copy FRAME->page was swapped out to. */
+static void
+vm_frame_drop_sharers (struct frame *frame) {
+	struct page *primary = frame->page;
+
+	while (!list_empty (&frame->pages)) {
+		struct page *page = list_entry (list_pop_front (&frame->pages),
+				struct page, frame_elem);
+
+		if (page != primary && VM_TYPE (page->operations->type) == VM_ANON)
+			anon_share_swapped (page, primary);
+		page->frame = NULL;
+	}
+}
+
+/* Get the struct frame, that will be evicted.
+ * Runs the CLOCK hand over the whole frame table: a frame whose page was
+ * accessed since the last sweep gets its accessed bit cleared and a second
+ * chance, the first one that was not is the victim. A frame shared by
+ * several pages goes as a whole, through the page it is charged to. Frames
+ * being filled or copied are skipped, and so are pages that would need
+ * writing if CLEAN_ONLY, and pages not charged to OWNER unless it is
+ * NULL. */
 static struct frame *
-vm_get_victim (void) {
+vm_get_victim (bool clean_only, struct thread *owner) {
 	 /* TODO: The policy for eviction is up to you. */
-	struct page* p;
-	struct hash_iterator i;
-	struct list *list_vic = &thread_current()->spt.list_vic;
-	struct vic_elem* vic;
+	ASSERT (lock_held_by_current_thread (&frame_lock));
 
-	while (list_size(list_vic)){
-		vic = list_entry (list_pop_front (list_vic), struct vic_elem, elem);
-		p = spt_find_page (&thread_current()->spt, vic->va);
+	for (size_t i = 0; i < 2 * frame_cnt; i++) {
+		struct frame *frame = &frame_table[clock_hand];
+		struct page *page = frame->page;
+		clock_hand = (clock_hand + 1) % frame_cnt;
 
-		if(p->frame == NULL || pg_ofs(p->frame->kva)){
-			list_push_back(list_vic, &vic->elem);
+		/* A share that no page holds is one being copied from. */
+		if (page == NULL || frame->pinned || frame->pin_cnt > 0
+				|| list_size (&frame->pages) != (size_t) frame->shared)
 			continue;
-		}
-		p->evict_cnt ++;
-		if(p->evict_cnt == 5){
-			free(vic);
+		if (owner != NULL && page->owner != owner)
 			continue;
-		}
-		break;
+		if (vm_frame_test_accessed (frame))
+			continue;
+		if (clean_only && !vm_frame_is_clean (frame))
+			continue;
+		fault_trace_add (page->va, page->owner != NULL ? page->owner->tid : 0,
+				false, FT_EVICT);
+		return frame;
+	}
+	return NULL;
+}
+
+/* Writes out the CNT frames in VICTIMS through their pages, with the frame
+ * lock released, setting KEPT[i] for each one that has to stay resident
+ * for now. The anonymous pages that need writing go to swap together. */
+static void
+vm_write_out (struct frame **victims, size_t cnt, bool *kept) {
+	struct thread *t = thread_current ();
+	struct page *cluster[SWAP_CLUSTER];
+	size_t cluster_cnt = 0;
+
+	t->evicting = true;
+	for (size_t i = 0; i < cnt; i++) {
+		struct page *page = victims[i]->page;
+
+		kept[i] = false;
+		if (anon_needs_writeback (page))
+			cluster[cluster_cnt++] = page;
+		else if (!swap_out (page))
+			kept[i] = true;
 	}
-	swap_out (p);
-	return palloc_get_page(PAL_USER|PAL_ZERO);
+	if (!anon_swap_out_cluster (cluster, cluster_cnt))
+		PANIC ("vm_evict_frame: out of swap space");
+	t->evicting = false;
 }
 
 /* Evict one page and return the corresponding frame.
- * Return NULL on error.*/
+ * Return NULL on error.
+ * Reclaim works in batches: up to SWAP_CLUSTER victims are taken at once,
+ * written out together, and every frame but the returned one goes back to
+ * the pool for the faults that follow. Only OWNER's pages are taken if it
+ * is not NULL.
+ * The frame lock is held on entry and on return, but not while victims are
+ * written out: they are pinned and marked as evicting meanwhile, and their
+ * pages keep pointing to them, so that anyone who would use or free one
+ * waits on EVICT_COND instead. A busy victim stays resident, and others
+ * are looked for as long as a sweep of the table lasts. */
 static struct frame *
-vm_evict_frame (void) {
-	struct frame *victim UNUSED = vm_get_victim ();
-	/* TODO: swap out the victim and return the evicted frame. */
-	return victim;
+vm_evict_frame (bool clean_only, struct thread *owner) {
+	struct frame *victims[SWAP_CLUSTER];
+	bool kept[SWAP_CLUSTER];
+	struct frame *frame = NULL;
+	size_t busy_cnt = 0;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	while (frame == NULL && busy_cnt < frame_cnt) {
+		size_t victim_cnt = 0;
+
+		while (victim_cnt < SWAP_CLUSTER) {
+			struct frame *victim = vm_get_victim (clean_only, owner);
+			if (victim == NULL)
+				break;
+			victim->pinned = true;
+			victim->evicting = true;
+			vm_frame_detach_sharers (victim);
+			victims[victim_cnt++] = victim;
+		}
+		if (victim_cnt == 0)
+			break;
+
+		lock_release (&frame_lock);
+		vm_write_out (victims, victim_cnt, kept);
+		lock_acquire (&frame_lock);
+
+		for (size_t i = 0; i < victim_cnt; i++) {
+			struct frame *victim = victims[i];
+
+			victim->evicting = false;
+			if (kept[i]) {
+				vm_frame_reattach_sharers (victim);
+				victim->pinned = false;
+				busy_cnt++;
+				continue;
+			}
+			vm_frame_drop_sharers (victim);
+			vm_text_remove (victim);
+			vm_frame_set_page (victim, NULL);
+			victim->shared = 0;
+			victim->dirty = false;
+			victim->merged = false;
+			if (frame == NULL)
+				frame = victim;
+			else {
+				victim->pinned = false;
+				palloc_free_page (victim->kva);
+			}
+		}
+		cond_broadcast (&evict_cond, &frame_lock);
+	}
+	if (frame != NULL)
+		memset (frame->kva, 0, PGSIZE);
+	return frame;
+}
+
+/* Waits until PAGE's frame, if it has one, is not being evicted. */
+static void
+vm_evict_wait (struct page *page) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	while (page->frame != NULL && page->frame->evicting)
+		cond_wait (&evict_cond, &frame_lock);
+}
+
+/* Returns true if the running thread is writing out frames it evicts.
+ * It must not wait for a frame or a lock that eviction may need then. */
+bool
+vm_evicting (void) {
+	return thread_current ()->evicting;
+}
+
+/* Wakes the reclaim thread if free frames are running low. Called without
+ * the frame lock when a free frame is taken. */
+static void
+vm_reclaim_kick (void) {
+	enum intr_level old_level;
+
+	if (palloc_user_free_cnt () >= reclaim_low_wmark)
+		return;
+	old_level = intr_disable ();
+	if (!reclaim_busy) {
+		reclaim_busy = true;
+		sema_up (&reclaim_sema);
+	}
+	intr_set_level (old_level);
+}
+
+/* The reclaim thread. Evicts a batch at a time, clean pages first since
+ * they cost no I/O, until the high watermark of free frames is reached,
+ * so that faults seldom have to evict themselves. */
+static void
+reclaim_daemon (void *aux UNUSED) {
+	for (;;) {
+		sema_down (&reclaim_sema);
+		for (;;) {
+			struct frame *frame = NULL;
+
+			lock_acquire (&frame_lock);
+			if (palloc_user_free_cnt () < reclaim_high_wmark) {
+				frame = vm_evict_frame (true, NULL);
+				if (frame == NULL)
+					frame = vm_evict_frame (false, NULL);
+			}
+			if (frame == NULL) {
+				reclaim_busy = false;
+				lock_release (&frame_lock);
+				break;
+			}
+			frame->pinned = false;
+			palloc_free_page (frame->kva);
+			reclaim_cnt++;
+			lock_release (&frame_lock);
+		}
+	}
+}
+
+/* Candidates for merging, by checksum of their contents. A slot may be
+ * stale; it is checked again before use. Protected by FRAME_LOCK. */
+#define MERGE_SLOTS 1024
+static struct merge_slot {
+	struct frame *frame;
+	unsigned sum;
+} merge_table[MERGE_SLOTS];
+
+/* Returns the page FRAME is mapped for if it is a resident anonymous page,
+ * or NULL. */
+static struct page *
+merge_page (struct frame *frame) {
+	struct page *page = frame->page;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	if (page == NULL || frame->pinned || frame->pin_cnt > 0
+			|| frame->text_inode != NULL
+			|| VM_TYPE (page->operations->type) != VM_ANON
+			|| page->anon.staged || page->is_mmap
+			|| page->owner->pml4 == NULL
+			|| pml4_get_page (page->owner->pml4, page->va) != frame->kva)
+		return NULL;
+	return page;
+}
+
+/* Maps PAGE, the only user of FRAME, to TARGET read-only and frees FRAME,
+ * if both hold the same bytes. The next write to PAGE, or to the page
+ * TARGET is mapped for, copies it again in vm_handle_wp(). Returns true
+ * if PAGE was merged. */
+static bool
+merge_into (struct frame *frame, struct page *page, struct frame *target) {
+	uint64_t *pml4 = page->owner->pml4;
+	struct page *tpage = target->page;
+	bool dirty = pml4_is_dirty (pml4, page->va);
+
+	/* Neither can change once both are read-only. */
+	pml4_set_writable (pml4, page->va, false);
+	if (tpage != NULL)
+		pml4_set_writable (tpage->owner->pml4, tpage->va, false);
+	if (memcmp (frame->kva, target->kva, PGSIZE)) {
+		pml4_set_writable (pml4, page->va, page->writable);
+		if (tpage != NULL)
+			pml4_set_writable (tpage->owner->pml4, tpage->va,
+					tpage->writable && target->shared == 1);
+		return false;
+	}
+
+	target->shared++;
+	if (target != zero_frame)
+		target->merged = true;
+	vm_frame_put (frame, page);
+	vm_frame_link (target, page);
+	pml4_set_page (pml4, page->va, target->kva, false);
+	/* The copy in swap, if any, is still out of date. */
+	if (dirty)
+		pml4_set_dirty (pml4, page->va, true);
+	return true;
+}
+
+/* Returns true if the page at KVA is all zeroes. */
+static bool
+merge_is_zero (const void *kva) {
+	const uint64_t *p = kva;
+	for (size_t i = 0; i < PGSIZE / sizeof *p; i++)
+		if (p[i] != 0)
+			return false;
+	return true;
+}
+
+/* Merges the anonymous page in FRAME, if it has FRAME to itself, into the
+ * zero frame or into a frame seen earlier with the same checksum.
+ * Otherwise FRAME becomes the candidate for its checksum. */
+static void
+merge_scan_frame (struct frame *frame) {
+	struct page *page = merge_page (frame);
+	struct merge_slot *slot;
+	unsigned sum;
+
+	if (page == NULL || frame->shared != 1)
+		return;
+	merge_scanned_cnt++;
+	if (merge_is_zero (frame->kva)) {
+		if (merge_into (frame, page, zero_frame))
+			merge_zero_cnt++;
+		return;
+	}
+
+	sum = hash_bytes (frame->kva, PGSIZE);
+	slot = &merge_table[sum % MERGE_SLOTS];
+	if (slot->frame != NULL && slot->frame != frame && slot->sum == sum
+			&& merge_page (slot->frame) != NULL
+			&& merge_into (frame, page, slot->frame)) {
+		merge_cnt++;
+		return;
+	}
+	slot->frame = frame;
+	slot->sum = sum;
+}
+
+/* The merge thread. */
+static void
+merge_daemon (void *aux UNUSED) {
+	size_t cnt = merge_scan_cnt < frame_cnt ? merge_scan_cnt : frame_cnt;
+
+	for (;;) {
+		timer_sleep (MERGE_INTERVAL);
+		lock_acquire (&frame_lock);
+		for (size_t i = 0; i < cnt; i++) {
+			merge_scan_frame (&frame_table[merge_hand]);
+			merge_hand = (merge_hand + 1) % frame_cnt;
+		}
+		lock_release (&frame_lock);
+	}
+}
+
+/* Prints frame reclaim statistics. */
+void
+vm_print_stats (void) {
+	printf ("Reclaim: %lld frames in background, %lld evictions in faults, "
+			"%lld at resident set limits\n",
+			reclaim_cnt, direct_evict_cnt, local_evict_cnt);
+	if (large_cnt > 0)
+		printf ("Large pages: %lld mapped\n", large_cnt);
+	if (merge_scan_cnt > 0)
+		printf ("Merge: %lld pages scanned, %lld merged, %lld into the zero "
+				"frame, %lld unmerged by writes\n", merge_scanned_cnt,
+				merge_cnt, merge_zero_cnt, unmerge_cnt);
+}
+
+/* A process's resident set is the frames it is charged for: those whose
+ * page, the one they are evicted through, it owns. A frame shared after
+ * fork stays charged to the process that had it first. Once a process
+ * has as many as its limit, its faults evict its own pages rather than
+ * anyone else's, so one process can not push out all the others. */
+
+/* Returns true if T can not take CNT more frames without going over its
+ * resident set limit. */
+static bool
+vm_rss_full (struct thread *t, int cnt) {
+	return t->rss_limit > 0
+		&& (size_t) (t->pnum_count + cnt) > t->rss_limit;
+}
+
+/* Makes PAGE, or none if NULL, the page FRAME is evicted through, moving
+ * the charge for FRAME to PAGE's owner. */
+void
+vm_frame_set_page (struct frame *frame, struct page *page) {
+	enum intr_level old_level = intr_disable ();
+
+	if (frame->page != NULL && frame->page->owner != NULL)
+		frame->page->owner->pnum_count--;
+	frame->page = page;
+	if (page != NULL && page->owner != NULL)
+		page->owner->pnum_count++;
+	intr_set_level (old_level);
+}
+
+/* Makes FRAME PAGE's frame. The first page to map a frame is the one it
+ * is charged to and evicted through. The caller holds the frame lock or
+ * has FRAME pinned. */
+void
+vm_frame_link (struct frame *frame, struct page *page) {
+	page->frame = frame;
+	list_push_back (&frame->pages, &page->frame_elem);
+	if (frame->page == NULL && frame != zero_frame)
+		vm_frame_set_page (frame, page);
+}
+
+/* Sets the resident set limit of the current process to PAGES frames, or
+ * none if 0, evicting its pages down to it. Returns the old limit. */
+size_t
+vm_set_rss_limit (size_t pages) {
+	struct thread *t = thread_current ();
+	size_t old = t->rss_limit;
+
+	t->rss_limit = pages;
+	while (vm_rss_full (t, 0)) {
+		struct frame *frame;
+
+		lock_acquire (&frame_lock);
+		frame = vm_evict_frame (false, t);
+		if (frame != NULL) {
+			frame->pinned = false;
+			palloc_free_page (frame->kva);
+			local_evict_cnt++;
+		}
+		lock_release (&frame_lock);
+		if (frame == NULL)
+			break;
+	}
+	return old;
+}
+
+/* Takes a frame for a page of T, which is held to T's resident set limit,
+ * or of no process if T is NULL. See vm_get_frame(). */
+static struct frame *
+vm_get_frame_for (struct thread *t) {
+	struct frame *frame = NULL;
+	void *kva = NULL;
+
+	uint64_t start = rdtsc ();
+	bool evicted = false;
+
+	/* A process at its limit makes room among its own pages first. */
+	if (t != NULL && vm_rss_full (t, 1)) {
+		lock_acquire (&frame_lock);
+		frame = vm_evict_frame (false, t);
+		if (frame != NULL) {
+			local_evict_cnt++;
+			evicted = true;
+		}
+		lock_release (&frame_lock);
+	}
+	if (frame == NULL) {
+		/* A free frame is no one else's, so taking one needs no lock. */
+		kva = palloc_get_page (PAL_USER | PAL_ZERO);
+		if (kva != NULL)
+			frame = vm_frame_lookup (kva);
+		else {
+			lock_acquire (&frame_lock);
+			frame = vm_evict_frame (false, NULL);
+			direct_evict_cnt++;
+			evicted = true;
+			lock_release (&frame_lock);
+		}
+	}
+	if (frame == NULL)
+		PANIC ("vm_get_frame: no frame to evict");
+	vm_reclaim_kick ();
+	frame->pinned = true;
+	frame->shared = 1;
+	if (evicted)
+		fault_stat_add (FT_EVICT, rdtsc () - start);
+
+	ASSERT (frame != NULL);
+	ASSERT (frame->page == NULL);
+	return frame;
 }
 
 /* palloc() and get frame. If there is no available page, evict the page
  * and return it. This always return valid address. That is, if the user pool
  * memory is full, this function evicts the frame to get the available memory
- * space.*/
+ * space.
+ * The frame comes back pinned; the caller links it to a page and unpins it
+ * once the contents are in place. */
+struct frame *
+vm_get_frame (void) {
+	/* TODO: Fill this function. */
+	return vm_get_frame_for (thread_current ());
+}
+
+/* Like vm_get_frame(), for a page no process is charged for, such as a
+ * page of the page cache, so the running process's resident set limit
+ * does not apply. */
+struct frame *
+vm_get_unowned_frame (void) {
+	return vm_get_frame_for (NULL);
+}
+
+/* Like vm_get_frame_for(), but only takes a free frame and returns NULL
+ * rather than evicting. */
 static struct frame *
-vm_get_frame (struct page* page) {
-	struct frame *frame = NULL;
-	/* TODO: Fill this function. */	
-	frame = palloc_get_page(PAL_USER | PAL_ZERO);
-	if(frame == NULL) frame = vm_evict_frame();
+vm_try_get_frame_for (struct thread *t) {
+	struct frame *frame;
+	void *kva;
+
+	if (t != NULL && vm_rss_full (t, 1))
+		return NULL;
+	kva = palloc_get_page (PAL_USER);
+	if (kva == NULL)
+		return NULL;
+	frame = vm_frame_lookup (kva);
+	frame->pinned = true;
+	frame->shared = 1;
+	vm_reclaim_kick ();
 
-	ASSERT (frame != NULL);
 	ASSERT (frame->page == NULL);
-	
-	struct vic_elem* vic = malloc(sizeof(struct vic_elem));
-	vic->va = page->va;
+	return frame;
+}
 
-	if (VM_TYPE(page->operations->type) == VM_UNINIT || VM_TYPE(page->operations->type) == VM_FILE)
-		list_push_back(&thread_current()->spt.list_vic, &(vic->elem));
-	else
-		list_push_front(&thread_current()->spt.list_vic, &(vic->elem));
-	page->frame->shared = 1;
+/* Like vm_get_frame(), but only takes a free frame and returns NULL rather
+ * than evicting. Used for speculative reads, which a process at its
+ * resident set limit does not get. */
+struct frame *
+vm_try_get_frame (void) {
+	return vm_try_get_frame_for (thread_current ());
+}
+
+/* Like vm_try_get_frame(), for a page no process is charged for. */
+struct frame *
+vm_try_get_unowned_frame (void) {
+	return vm_try_get_frame_for (NULL);
+}
+
+/* Takes LGPG_PAGES free frames that start 2 MiB aligned, for a large
+ * page, if that leaves enough free. Returns the first frame's kernel
+ * address, or NULL. */
+static uint8_t *
+vm_try_get_large_frames (void) {
+	uint8_t *kva;
+
+	if (palloc_user_free_cnt () < LGPG_PAGES + reclaim_high_wmark
+			|| vm_rss_full (thread_current (), LGPG_PAGES))
+		return NULL;
+	kva = palloc_get_aligned (PAL_USER, LGPG_PAGES, LGPG_PAGES);
+	if (kva == NULL)
+		return NULL;
+	for (size_t i = 0; i < LGPG_PAGES; i++) {
+		struct frame *frame = vm_frame_lookup (kva + i * PGSIZE);
+		ASSERT (frame->page == NULL);
+		frame->pinned = true;
+		frame->shared = 1;
+	}
+	vm_reclaim_kick ();
+	return kva;
+}
+
+/* Gives the frames vm_try_get_large_frames() took at KVA back to the user
+ * pool, unused. */
+static void
+vm_free_large_frames (uint8_t *kva) {
+	for (size_t i = 0; i < LGPG_PAGES; i++) {
+		struct frame *frame = vm_frame_lookup (kva + i * PGSIZE);
+		frame->shared = 0;
+		frame->pinned = false;
+	}
+	palloc_free_multiple (kva, LGPG_PAGES);
+}
+
+/* Gives FRAME, which no page uses, back to the user pool. */
+void
+vm_free_frame (struct frame *frame) {
+	lock_acquire (&frame_lock);
+	ASSERT (frame->page == NULL);
+	frame->shared = 0;
+	frame->pinned = false;
+	palloc_free_page (frame->kva);
+	lock_release (&frame_lock);
+}
+
+/* Drops PAGE's share of FRAME, giving FRAME back to the user pool with
+ * the last one. */
+static void
+vm_frame_put (struct frame *frame, struct page *page) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	/* A frame still shared by others is evicted through one of them from
+	 * now on. */
+	list_remove (&page->frame_elem);
+	if (frame->page == page)
+		vm_frame_set_page (frame, list_empty (&frame->pages) ? NULL
+				: list_entry (list_front (&frame->pages), struct page,
+					frame_elem));
+	page->frame = NULL;
+	if (--frame->shared <= 0) {
+		frame->shared = 0;
+		frame->pinned = false;
+		frame->dirty = false;
+		frame->merged = false;
+		vm_text_remove (frame);
+		palloc_free_page (frame->kva);
+	}
+}
+
+/* Unmaps PAGE from FRAME and drops its share. A frame that others still
+ * share remembers that PAGE wrote to it. */
+static void
+vm_frame_unmap (struct frame *frame, struct page *page) {
+	uint64_t *pml4 = page->owner != NULL ? page->owner->pml4 : NULL;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	if (pml4 != NULL) {
+		if (frame->shared > 1 && pml4_is_dirty (pml4, page->va))
+			frame->dirty = true;
+		pml4_clear_page (pml4, page->va);
+	}
+	vm_frame_put (frame, page);
+}
+
+/* Returns PAGE's frame pinned, so that it stays PAGE's until
+ * vm_frame_unpin(), or NULL if PAGE is not resident. A frame being
+ * evicted is waited for. Several threads may pin a frame at once. */
+struct frame *
+vm_frame_pin (struct page *page) {
+	struct frame *frame;
+
+	lock_acquire (&frame_lock);
+	vm_evict_wait (page);
+	frame = page->frame;
+	if (frame != NULL)
+		frame->pin_cnt++;
+	lock_release (&frame_lock);
+	return frame;
+}
+
+/* Like vm_frame_pin(), for eviction, which can not wait for a frame that
+ * may be its own victim. Sets *FRAME as vm_frame_pin() returns, unless
+ * PAGE's frame is being evicted, in which case false is returned. */
+bool
+vm_frame_try_pin (struct page *page, struct frame **frame) {
+	bool pinned = true;
+
+	lock_acquire (&frame_lock);
+	*frame = page->frame;
+	if (*frame != NULL && (*frame)->evicting)
+		pinned = false;
+	else if (*frame != NULL)
+		(*frame)->pin_cnt++;
+	lock_release (&frame_lock);
+	return pinned;
+}
+
+/* Drops a pin vm_frame_pin() took, letting FRAME be evicted again after
+ * the last one. */
+void
+vm_frame_unpin (struct frame *frame) {
+	lock_acquire (&frame_lock);
+	ASSERT (frame->pin_cnt > 0);
+	frame->pin_cnt--;
+	lock_release (&frame_lock);
+}
+
+/* Drops PAGE's hold on its frame: unmaps it from the owner's page table and
+ * gives the frame back to the user pool once no other page shares it. If
+ * the frame is being evicted, PAGE ends up holding the copy written out
+ * instead. */
+void
+vm_release_frame (struct page *page) {
+	if (page->frame == NULL)
+		return;
+
+	lock_acquire (&frame_lock);
+	vm_evict_wait (page);
+	if (page->frame != NULL)
+		vm_frame_unmap (page->frame, page);
+	lock_release (&frame_lock);
+}
+
+/* Like vm_release_frame(), but only if other pages share PAGE's frame, so
+ * that the last one to let go of a mapping's frame writes it back.
+ * Returns true if PAGE let go. */
+bool
+vm_release_shared_frame (struct page *page) {
+	bool released = false;
+
+	if (page->frame == NULL)
+		return false;
+	lock_acquire (&frame_lock);
+	vm_evict_wait (page);
+	if (page->frame != NULL && page->frame->shared > 1) {
+		vm_frame_unmap (page->frame, page);
+		released = true;
+	}
+	lock_release (&frame_lock);
+	return released;
+}
+
+static uint64_t
+text_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct frame *f = hash_entry (e, struct frame, text_elem);
+	return hash_bytes (&f->text_inode, sizeof f->text_inode)
+		^ hash_int (f->text_ofs) ^ hash_int (f->text_len);
+}
+
+static bool
+text_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct frame *a = hash_entry (a_, struct frame, text_elem);
+	const struct frame *b = hash_entry (b_, struct frame, text_elem);
+	if (a->text_mmap != b->text_mmap)
+		return a->text_mmap < b->text_mmap;
+	if (a->text_inode != b->text_inode)
+		return a->text_inode < b->text_inode;
+	if (a->text_ofs != b->text_ofs)
+		return a->text_ofs < b->text_ofs;
+	return a->text_len < b->text_len;
+}
+
+/* Looks for a frame holding the LEN bytes of INODE at OFS as shared text,
+ * or as a page of shared mappings if MMAP. If there is one, PAGE takes a
+ * share of it and is linked to it, and the frame is returned; the caller
+ * maps it. Returns NULL
+ * otherwise. */
+struct frame *
+vm_text_get (struct inode *inode, off_t ofs, uint32_t len, bool mmap,
+		struct page *page) {
+	struct frame key, *frame = NULL;
+	struct hash_elem *e;
+
+	key.text_inode = inode;
+	key.text_ofs = ofs;
+	key.text_len = len;
+	key.text_mmap = mmap;
+	lock_acquire (&frame_lock);
+	while ((e = hash_find (&text_table, &key.text_elem)) != NULL) {
+		frame = hash_entry (e, struct frame, text_elem);
+		if (!frame->evicting) {
+			frame->shared++;
+			vm_frame_link (frame, page);
+			break;
+		}
+		/* Unless it was kept, the bytes are back in the file after. */
+		cond_wait (&evict_cond, &frame_lock);
+		frame = NULL;
+	}
+	lock_release (&frame_lock);
 	return frame;
 }
 
+/* Returns true if vm_text_get() would likely find a frame for the LEN
+ * bytes of INODE at OFS right now. */
+bool
+vm_text_resident (struct inode *inode, off_t ofs, uint32_t len, bool mmap) {
+	struct frame key;
+	bool found;
+
+	key.text_inode = inode;
+	key.text_ofs = ofs;
+	key.text_len = len;
+	key.text_mmap = mmap;
+	lock_acquire (&frame_lock);
+	found = hash_find (&text_table, &key.text_elem) != NULL;
+	lock_release (&frame_lock);
+	return found;
+}
+
+/* Offers FRAME, just loaded with the LEN bytes of INODE at OFS, to later
+ * vm_text_get() calls with the same MMAP. Returns false if another frame
+ * holds them already. */
+bool
+vm_text_add (struct frame *frame, struct inode *inode, off_t ofs,
+		uint32_t len, bool mmap) {
+	bool added = true;
+
+	lock_acquire (&frame_lock);
+	if (frame->text_inode == NULL) {
+		frame->text_inode = inode;
+		frame->text_ofs = ofs;
+		frame->text_len = len;
+		frame->text_mmap = mmap;
+		if (hash_insert (&text_table, &frame->text_elem) != NULL) {
+			frame->text_inode = NULL;
+			added = false;
+		}
+	}
+	lock_release (&frame_lock);
+	return added;
+}
+
+/* Stops sharing FRAME as text, once it is evicted or freed. */
+static void
+vm_text_remove (struct frame *frame) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	if (frame->text_inode != NULL) {
+		hash_delete (&text_table, &frame->text_elem);
+		frame->text_inode = NULL;
+	}
+}
+
 /* Growing the stack. */
 static void
 vm_stack_growth (void *addr UNUSED) {
-	//still implementing
-	struct page *kpage;
-	struct frame *frame;
-	uint8_t *kva;
-	bool succ;
 	uint64_t ad = (uint64_t) addr / 0x1000 * 0x1000;
 	struct supplemental_page_table *spt = &thread_current()->spt;
 	while (spt->stack_bottom > ad){
 		spt->stack_bottom -= 0x1000;
-		kpage = malloc(sizeof(struct page));
-		frame = malloc(sizeof(struct frame));
-		frame->page = kpage;
-		kpage->frame = frame;
-		kpage->writable = true;
-		kpage->va = spt->stack_bottom;
-		kva = vm_get_frame (kpage);
-		if (kva != NULL) {
-			if (pml4_set_page (thread_current()->pml4, spt->stack_bottom, kva, true)) {
-				frame->kva = pml4_get_page(thread_current()->pml4, kpage->va);
-			}
-			else palloc_free_page (frame);
-		}
-		kpage->frame->kva = kva;
-		anon_initializer (kpage, VM_ANON + VM_MARKER_0, NULL);
-		spt_insert_page(spt, kpage);
-		kpage->is_stack = true;
+		if (!vm_alloc_page (VM_ANON | VM_MARKER_0, spt->stack_bottom, true)
+				|| !vm_claim_page (spt->stack_bottom))
+			process_exit ();
+		spt_find_page (spt, spt->stack_bottom)->is_stack = true;
 	}
 }
 
-/* Handle the fault on write_protected page */
+/* Handle the fault on write_protected page.
+ * After fork, the parent and the child map each resident page read-only
+ * and share its frame. The first write to it copies the frame, unless
+ * every other sharer has let go of it already, in which case writes are
+ * just enabled again. */
 static bool
-vm_handle_wp (struct page *page UNUSED) {
+vm_handle_wp (struct page *page) {
+	struct frame *old;
+	struct frame *frame;
+
+	lock_acquire (&frame_lock);
+	vm_evict_wait (page);
+	old = page->frame;
+	if (old == NULL) {
+		/* Evicted meanwhile; the write faults it back in. */
+		lock_release (&frame_lock);
+		return true;
+	}
+	if (old->shared == 1) {
+		vm_frame_set_page (old, page);
+		old->merged = false;
+		lock_release (&frame_lock);
+		pml4_set_writable (page->owner->pml4, page->va, true);
+		return true;
+	}
+	/* An extra share keeps OLD from being evicted or freed meanwhile. */
+	old->shared++;
+	if (old->merged)
+		unmerge_cnt++;
+	lock_release (&frame_lock);
+
+	frame = vm_get_frame ();
+	if (old != zero_frame)
+		memcpy (frame->kva, old->kva, PGSIZE);
+
+	lock_acquire (&frame_lock);
+	old->shared--;
+	pml4_clear_page (page->owner->pml4, page->va);
+	vm_frame_put (old, page);
+	lock_release (&frame_lock);
+
+	vm_frame_link (frame, page);
+	frame->pinned = false;
+	if (!pml4_set_page (page->owner->pml4, page->va, frame->kva, true)) {
+		vm_release_frame (page);
+		return false;
+	}
+	pml4_set_dirty (page->owner->pml4, page->va, true);
+	return true;
 }
 
-/* Return true on success */
-bool
-vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
-		bool user UNUSED, bool write UNUSED, bool not_present UNUSED) {
+/* Maps the zero frame read-only for PAGE if it is an anonymous page that
+ * has never been touched, so that reading it takes no memory. The first
+ * write gets it a frame of its own through vm_handle_wp(). */
+static bool
+vm_map_zero (struct page *page) {
+	if (VM_TYPE (page->operations->type) != VM_UNINIT
+			|| VM_TYPE (page->uninit.type) != VM_ANON
+			|| page->uninit.init != NULL)
+		return false;
+
+	lock_acquire (&frame_lock);
+	zero_frame->shared++;
+	vm_frame_link (zero_frame, page);
+	lock_release (&frame_lock);
+	if (!swap_in (page, zero_frame->kva)
+			|| !pml4_set_page (page->owner->pml4, page->va, zero_frame->kva,
+				false)) {
+		vm_release_frame (page);
+		return false;
+	}
+	return true;
+}
+
+/* Maps the 2 MiB around ADDR with one large page if one area covers all of
+ * it, none of it was touched yet and aligned free frames are at hand. Every
+ * page still has its own struct page and frame, so the large page is split
+ * back into small ones by the first change to one of them: copy-on-write,
+ * eviction or unmapping (see pde_split()). Untouched bss is left to
+ * vm_map_zero() until written. Returns true if the large page is mapped. */
+static bool
+vm_map_large (struct supplemental_page_table *spt, void *addr, bool write) {
+	uint8_t *base = lg_round_down (addr);
+	struct vma *vma = vma_find (spt, addr);
+	uint8_t *kva;
+	size_t ofs;
+	off_t got = 0;
+
+	if (!vm_large_pages || vma == NULL || vma->is_text
+			|| base < (uint8_t *) vma->start
+			|| base + LGPGSIZE > (uint8_t *) vma->end)
+		return false;
+	ofs = base - (uint8_t *) vma->start;
+	if (!write && vma->type == VM_ANON && vma->read_bytes <= ofs)
+		return false;
+	if (spt_find_page (spt, addr) != NULL)
+		return false;
+	/* Frames first, since that fails most often, and costs nothing to
+	 * undo. */
+	kva = vm_try_get_large_frames ();
+	if (kva == NULL)
+		return false;
+	for (size_t i = 0; i < LGPG_PAGES; i++)
+		if (spt_find_page (spt, base + i * PGSIZE) != NULL) {
+			vm_free_large_frames (kva);
+			return false;
+		}
+	for (size_t i = 0; i < LGPG_PAGES; i++)
+		if (vma_get_page (spt, base + i * PGSIZE) == NULL) {
+			/* The pages made so far just load on their own. */
+			vm_free_large_frames (kva);
+			return false;
+		}
+
+	if (vma->read_bytes > ofs)
+		got = file_read_at (vma->file, kva, vma->read_bytes - ofs < LGPGSIZE
+				? vma->read_bytes - ofs : LGPGSIZE, vma->offset + ofs);
+	memset (kva + got, 0, LGPGSIZE - got);
+
+	for (size_t i = 0; i < LGPG_PAGES; i++) {
+		struct page *page = spt_find_page (spt, base + i * PGSIZE);
+		struct frame *frame = vm_frame_lookup (kva + i * PGSIZE);
+		void *aux = page->uninit.aux;
+
+		page->uninit.page_initializer (page, page->uninit.type, frame->kva);
+		if (VM_TYPE (page->operations->type) == VM_FILE)
+			page->file.aux = aux;
+		else
+			free (aux);
+		vm_frame_link (frame, page);
+	}
+	if (pml4_set_large_page (thread_current ()->pml4, base, kva,
+				vma->writable))
+		large_cnt++;
+	else
+		for (size_t i = 0; i < LGPG_PAGES; i++)
+			pml4_set_page (thread_current ()->pml4, base + i * PGSIZE,
+					kva + i * PGSIZE, vma->writable);
+	for (size_t i = 0; i < LGPG_PAGES; i++) {
+		struct page *page = spt_find_page (spt, base + i * PGSIZE);
+		page->frame->pinned = false;
+		/* Another process has this page of the file; use theirs. */
+		if (page->is_mmap && !file_share_text (page))
+			vm_release_frame (page);
+	}
+	return true;
+}
+
+/* Handles the fault, setting *TYPE to what it did. */
+static bool
+vm_handle_fault (struct intr_frame *f, void *addr, bool write,
+		bool not_present, enum fault_type *type) {
 	struct supplemental_page_table *spt UNUSED = &thread_current ()->spt;
 	struct page *page = NULL;
 	/* TODO: Validate the fault */
 	/* TODO: Your code goes here */
 	if(!is_user_vaddr(addr)) process_exit();
-	page = spt_find_page(spt, addr);
+	if (vm_map_large (spt, addr, write)) {
+		*type = FT_LOAD;
+		fault_trace_add (addr, thread_tid (), write, *type);
+		return true;
+	}
+	page = vma_get_page (spt, addr);
 	if (page == 0) {
 		if (addr >= stack_limit && addr < spt->stack_bottom && (f->rsp) != (f->R.rbp)) {
+			*type = FT_STACK;
+			fault_trace_add (addr, thread_tid (), write, *type);
 			vm_stack_growth (addr);
 			return true;
 		}
 		else process_exit();
 	}
+	/* After an eviction in progress, PAGE may no longer be resident. */
+	if (page->frame != NULL) {
+		lock_acquire (&frame_lock);
+		vm_evict_wait (page);
+		lock_release (&frame_lock);
+	}
 	if (page->frame != NULL) {
-		if (page->writable && page->frame->shared > 1) {
-			struct frame *frame = malloc(sizeof(struct frame));
-			uint8_t *kpage = vm_get_frame(page);
-			memcpy (kpage, page->frame->kva, 0x1000);
-			frame->page = page;
-			page->frame = frame;
-			pml4_clear_page (thread_current()->pml4, page->va);
-			pml4_set_page (thread_current()->pml4, page->va, kpage, true);
-			frame->kva = pml4_get_page (thread_current()->pml4, page->va);
+		if (anon_claim_staged (page)) {
+			*type = FT_STAGED;
+			fault_trace_add (addr, thread_tid (), write, *type);
 			return true;
 		}
-		else process_exit();
+		if (write && !not_present && page->writable) {
+			*type = FT_WP;
+			fault_trace_add (addr, thread_tid (), write, *type);
+			return vm_handle_wp (page);
+		}
+		process_exit ();
 	}
+	if (!write && vm_map_zero (page)) {
+		*type = FT_ZERO;
+		fault_trace_add (addr, thread_tid (), write, *type);
+		return true;
+	}
+	*type = VM_TYPE (page->operations->type) == VM_UNINIT ? FT_LOAD : FT_SWAP;
+	fault_trace_add (addr, thread_tid (), write, *type);
 	return vm_do_claim_page (page);
 }
 
+/* Return true on success */
+bool
+vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
+		bool user UNUSED, bool write UNUSED, bool not_present UNUSED) {
+	uint64_t start = rdtsc ();
+	enum fault_type type = FT_LOAD;
+	bool success = vm_handle_fault (f, addr, write, not_present, &type);
+
+	fault_stat_add (type, rdtsc () - start);
+	return success;
+}
+
 /* Free the page.
  * DO NOT MODIFY THIS FUNCTION. */
 void
@@ -244,21 +1512,39 @@ vm_dealloc_page (struct page *page) {
 bool
 vm_claim_page (void *va UNUSED) {
 	/* TODO: Fill this function */
-	return vm_do_claim_page (spt_find_page (&thread_current()->spt, va));
+	struct page *page = spt_find_page (&thread_current()->spt, va);
+	if (page == NULL)
+		return false;
+	return vm_do_claim_page (page);
 }
 
 /* Claim the PAGE and set up the mmu. */
 static bool
 vm_do_claim_page (struct page *page) {
-	struct frame *frame = malloc(sizeof(struct frame));
-	frame->page = page;
-	page->frame = frame;
-	uint8_t *kpage = vm_get_frame(page);
-	frame->kva = kpage;
+	struct frame *frame;
+
+	if ((page->is_text || page->is_mmap) && file_map_text (page))
+		return true;
+	frame = vm_get_frame ();
+
 	/* Set links */
+	vm_frame_link (frame, page);
 
 	/* TODO: Insert page table entry to map page's VA to frame's PA. */
-	return swap_in (page, frame->kva);
+	bool success = swap_in (page, frame->kva)
+		&& pml4_set_page (page->owner->pml4, page->va, frame->kva,
+				page->writable);
+	frame->pinned = false;
+	if (!success) {
+		vm_release_frame (page);
+		return false;
+	}
+	/* Someone else loaded the same bytes meanwhile; use their frame. */
+	if ((page->is_text || page->is_mmap) && !file_share_text (page)) {
+		vm_release_frame (page);
+		return vm_do_claim_page (page);
+	}
+	return true;
 }
 
 bool 
@@ -277,13 +1563,7 @@ apply_hash (const struct hash_elem *e, void *aux){
 void
 free_hash (struct hash_elem *e, void *aux){
 	struct page *page1 = hash_entry(e, struct page, elem);
-	if(page1->frame != NULL && page1->frame->shared>1){
-		page1->frame->shared --;
-		pml4_clear_page(thread_current()->pml4, page1->va);
-		free(page1);
-	}
-	else
-		destroy(page1);
+	vm_dealloc_page (page1);
 }
 
 /* Initialize new supplemental page table */
@@ -291,9 +1571,21 @@ void
 supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
 	struct hash *hash = malloc(sizeof(struct hash));
 	hash_init(hash, apply_hash, compare_hash, NULL);
-	list_init(&spt->list_vic);
 	spt->hash_table = hash;
 	spt->stack_bottom = (void *) (((uint8_t *) USER_STACK) - PGSIZE);
+	list_init (&spt->vma_list);
+}
+
+/* Returns a copy of the lazyload AUX, or NULL if there is none or memory
+ * is short. */
+static struct lazyload *
+lazyload_dup (const struct lazyload *aux) {
+	struct lazyload *copy;
+
+	if (aux == NULL || (copy = malloc (sizeof *copy)) == NULL)
+		return NULL;
+	*copy = *aux;
+	return copy;
 }
 
 /* Copy supplemental page table from src to dst */
@@ -302,30 +1594,59 @@ supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
 		struct supplemental_page_table *src UNUSED) {
 	struct hash *dhash = dst->hash_table;
 	struct hash_iterator iter;
+	dst->stack_bottom = src->stack_bottom;
+	for (struct list_elem *e = list_begin (&src->vma_list);
+			e != list_end (&src->vma_list); e = list_next (e)) {
+		struct vma *vma = malloc (sizeof *vma);
+		if (vma == NULL)
+			return false;
+		*vma = *list_entry (e, struct vma, elem);
+		list_push_back (&dst->vma_list, &vma->elem);
+	}
    	hash_first (&iter, src->hash_table);
    	while (hash_next (&iter)) {
 		struct page* dpage = malloc(sizeof(struct page));
   		struct page* spage = hash_entry (hash_cur (&iter), struct page, elem);
+		bool success = true;
+		if (dpage == NULL)
+			return false;
+		/* The frame lock keeps SPAGE from being evicted while it is
+		 * copied and its frame shared. */
+		lock_acquire (&frame_lock);
+		vm_evict_wait (spage);
 		memcpy(dpage, spage, sizeof(struct page));
-		if(spage->frame != NULL) {
-			struct frame *frame = spage->frame;
-			if (spage->is_stack) {
-				struct frame *frame = malloc(sizeof(struct frame));
-				frame->page = dpage;
-				dpage->frame = frame;
-				uint8_t *kpage = vm_get_frame (dpage);
-				memcpy(kpage, spage->frame->kva, 0x1000);
-				pml4_clear_page (thread_current()->pml4, dpage->va);
-				pml4_set_page (thread_current()->pml4, dpage->va, kpage, true);
-				frame->kva = pml4_get_page (thread_current()->pml4, dpage->va);
-			}
-			dpage->frame = frame;
-			pml4_clear_page (thread_current()->pml4, dpage->va);
-			pml4_set_page (thread_current()->pml4, dpage->va, frame->kva, false);
-			spage->frame->shared++;
-			dpage->frame->shared = spage->frame->shared;
+		dpage->owner = thread_current ();
+		/* Each page owns its lazyload. */
+		if (VM_TYPE (spage->operations->type) == VM_UNINIT
+				&& spage->uninit.aux != NULL) {
+			dpage->uninit.aux = lazyload_dup (spage->uninit.aux);
+			success = dpage->uninit.aux != NULL;
+		} else if (VM_TYPE (spage->operations->type) == VM_FILE) {
+			dpage->file.aux = lazyload_dup (spage->file.aux);
+			success = dpage->file.aux != NULL;
+		}
+		if (!success) {
+			lock_release (&frame_lock);
+			free (dpage);
+			return false;
+		}
+		if (VM_TYPE (spage->operations->type) == VM_ANON)
+			anon_fork_page (dpage);
+		/* Both processes map a resident page read-only and share the
+		 * frame until one of them writes it, see vm_handle_wp(). Pages
+		 * of mappings stay shared and writable. */
+		if(dpage->frame != NULL) {
+			dpage->frame->shared++;
+			list_push_back (&dpage->frame->pages, &dpage->frame_elem);
+			if (!dpage->is_mmap)
+				pml4_set_writable (spage->owner->pml4, spage->va, false);
+			success = pml4_set_page (dpage->owner->pml4, dpage->va,
+					dpage->frame->kva, dpage->is_mmap && dpage->writable);
 		}
+		lock_release (&frame_lock);
 		hash_insert(dhash, &(dpage->elem));
+		if (!success)
+			return false;
    	}
 	return true;
 }
@@ -335,6 +1656,9 @@ void
 supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
 	/* TODO: Destroy all the supplemental_page_table hold by thread and
 	 * TODO: writeback all the modified contents to the storage. */
-	if(spt->hash_table == NULL || hash_size(spt->hash_table) == 0) return;
+	if(spt->hash_table == NULL) return;
+	while (!list_empty (&spt->vma_list))
+		free (list_entry (list_pop_front (&spt->vma_list), struct vma, elem));
+	if(hash_size(spt->hash_table) == 0) return;
 	hash_destroy (spt -> hash_table, free_hash);
 }
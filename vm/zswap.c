@@ -0,0 +1,367 @@
+/* zswap.c: Compressed in-memory cache in front of the swap disk.
+ *
+ * Anonymous pages that are swapped out are compressed into an arena of
+ * kernel pages instead of going to disk. The arena is filled like a log:
+ * new pages are appended at the head, and when there is no room the
+ * oldest ones are decompressed and written to swap slots. A page that is
+ * faulted back in while still in the arena costs no disk I/O at all. */
+
+#include "vm/zswap.h"
+#include "vm/vm.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include <bitmap.h>
+#include <list.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Size of the arena, in pages. */
+#define ZSWAP_PAGES 32
+#define ZSWAP_SIZE (ZSWAP_PAGES * PGSIZE)
+
+/* Pages that do not compress to this size or less go to disk. */
+#define ZSWAP_MAX_LEN (PGSIZE * 3 / 4)
+
+/* A swapped out page, shared by the pages of forked processes. */
+struct zswap_entry {
+	struct list_elem elem;      /* In ARENA_LIST while in the arena. */
+	size_t ofs;                 /* Offset of the data in the arena. */
+	size_t len;                 /* Compressed length. */
+	int refs;                   /* Pages that hold this entry. */
+	struct page *page;          /* The page that holds it, if only one. */
+	int slot;                   /* Swap slot once written back, or -1. */
+};
+
+static uint8_t *arena;
+static size_t arena_head;         /* Where the next entry goes. */
+static struct list arena_list;    /* Entries in the arena, oldest first. */
+static struct lock zswap_lock;
+
+/* Scratch pages for compressing, and for writing back, which may happen
+ * while ZSWAP_BUF holds a page being stored. */
+static uint8_t *zswap_buf;
+static uint8_t *writeback_buf;
+
+/* Statistics. */
+static long long stored_cnt;      /* Pages compressed into the arena. */
+static long long stored_bytes;    /* Their compressed size. */
+static long long rejected_cnt;    /* Pages that did not compress well. */
+static long long hit_cnt;         /* Swap-ins served from the arena. */
+static long long miss_cnt;        /* Swap-ins after write back. */
+static long long writeback_cnt;   /* Entries written back to disk. */
+
+/* LZ77 codec in the style of LZ4. The output is a list of sequences,
+ * each a token byte holding a literal count in the high nibble and a
+ * match length minus 4 in the low one, either extended by bytes of 255
+ * when 15, then the literals and a 2-byte little-endian match offset.
+ * The last sequence has literals only. */
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 10
+
+/* Last position of every hashed 4-byte sequence. Protected by
+ * ZSWAP_LOCK. */
+static uint16_t lz_table[1 << LZ_HASH_BITS];
+
+static uint32_t
+lz_read32 (const uint8_t *p) {
+	uint32_t v;
+	memcpy (&v, p, sizeof v);
+	return v;
+}
+
+static size_t
+lz_hash (uint32_t v) {
+	return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Writes the rest of a length that did not fit in its nibble. */
+static uint8_t *
+lz_put_len (uint8_t *op, size_t len) {
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = len;
+	return op;
+}
+
+/* Emits one sequence of LIT literals at ANCHOR followed, unless MLEN is
+ * zero, by a match of MLEN bytes at distance OFS. Returns the new output
+ * position, or NULL if it would pass OEND. */
+static uint8_t *
+lz_put_seq (uint8_t *op, uint8_t *oend, const uint8_t *anchor, size_t lit,
+		size_t ofs, size_t mlen) {
+	size_t mcode = mlen != 0 ? mlen - LZ_MIN_MATCH : 0;
+	uint8_t *token;
+
+	if ((size_t) (oend - op) < 1 + lit / 255 + 1 + lit + 2 + mcode / 255 + 1)
+		return NULL;
+	token = op++;
+	*token = (lit >= 15 ? 15 : lit) << 4 | (mcode >= 15 ? 15 : mcode);
+	if (lit >= 15)
+		op = lz_put_len (op, lit - 15);
+	memcpy (op, anchor, lit);
+	op += lit;
+	if (mlen != 0) {
+		*op++ = ofs & 0xff;
+		*op++ = ofs >> 8;
+		if (mcode >= 15)
+			op = lz_put_len (op, mcode - 15);
+	}
+	return op;
+}
+
+/* Compresses the SIZE bytes at SRC into DST. Returns the compressed size,
+ * or 0 if it would be more than LIMIT bytes. */
+static size_t
+lz_compress (const uint8_t *src, size_t size, uint8_t *dst, size_t limit) {
+	const uint8_t *ip = src, *anchor = src, *end = src + size;
+	uint8_t *op = dst, *oend = dst + limit;
+
+	memset (lz_table, 0, sizeof lz_table);
+	while (ip + LZ_MIN_MATCH <= end) {
+		uint32_t seq = lz_read32 (ip);
+		size_t h = lz_hash (seq);
+		const uint8_t *ref = src + lz_table[h];
+		const uint8_t *m;
+
+		lz_table[h] = ip - src;
+		if (ref >= ip || lz_read32 (ref) != seq) {
+			ip++;
+			continue;
+		}
+		for (m = ip + LZ_MIN_MATCH; m < end && *m == ref[m - ip]; m++)
+			continue;
+		op = lz_put_seq (op, oend, anchor, ip - anchor, ip - ref, m - ip);
+		if (op == NULL)
+			return 0;
+		ip = anchor = m;
+	}
+	op = lz_put_seq (op, oend, anchor, end - anchor, 0, 0);
+	return op != NULL ? (size_t) (op - dst) : 0;
+}
+
+/* Decompresses the SIZE bytes at SRC into the DST_SIZE bytes at DST.
+ * Returns false if they do not decode to exactly DST_SIZE bytes. */
+static bool
+lz_decompress (const uint8_t *src, size_t size, uint8_t *dst,
+		size_t dst_size) {
+	const uint8_t *ip = src, *iend = src + size;
+	uint8_t *op = dst, *oend = dst + dst_size;
+
+	while (ip < iend) {
+		uint8_t token = *ip++;
+		size_t lit = token >> 4, mlen = token & 15, ofs;
+
+		if (lit == 15)
+			do
+				lit += *ip;
+			while (*ip++ == 255);
+		if (lit > (size_t) (oend - op) || lit > (size_t) (iend - ip))
+			return false;
+		memcpy (op, ip, lit);
+		op += lit;
+		ip += lit;
+		if (ip >= iend)
+			break;
+
+		ofs = ip[0] | ip[1] << 8;
+		ip += 2;
+		if (mlen == 15)
+			do
+				mlen += *ip;
+			while (*ip++ == 255);
+		mlen += LZ_MIN_MATCH;
+		if (ofs == 0 || ofs > (size_t) (op - dst)
+				|| mlen > (size_t) (oend - op))
+			return false;
+		/* Byte by byte, since the match may overlap its own output. */
+		for (const uint8_t *r = op - ofs; mlen > 0; mlen--)
+			*op++ = *r++;
+	}
+	return op == oend;
+}
+
+/* Sets up the arena. */
+void
+zswap_init (void) {
+	arena = palloc_get_multiple (PAL_ASSERT, ZSWAP_PAGES);
+	zswap_buf = palloc_get_page (PAL_ASSERT);
+	writeback_buf = palloc_get_page (PAL_ASSERT);
+	arena_head = 0;
+	list_init (&arena_list);
+	lock_init (&zswap_lock);
+}
+
+/* Writes the oldest entry in the arena to a swap slot, which then holds
+ * one reference for every page that holds the entry, and can be read
+ * ahead if that is one page. Returns false if swap is full. */
+static bool
+zswap_writeback (void) {
+	struct zswap_entry *e = list_entry (list_front (&arena_list),
+			struct zswap_entry, elem);
+	size_t slot;
+
+	ASSERT (lock_held_by_current_thread (&zswap_lock));
+	slot = swap_slot_alloc (1);
+	if (slot == BITMAP_ERROR)
+		return false;
+	for (int i = 1; i < e->refs; i++)
+		swap_slot_dup (slot);
+	if (!lz_decompress (arena + e->ofs, e->len, writeback_buf, PGSIZE))
+		PANIC ("zswap: corrupted entry");
+	swap_write_slot (slot, writeback_buf);
+	if (e->refs == 1)
+		swap_slot_set_page (slot, e->page);
+	e->slot = slot;
+	list_remove (&e->elem);
+	writeback_cnt++;
+	return true;
+}
+
+/* Finds room for LEN bytes in the arena, writing back the oldest entries
+ * as needed. Returns its offset, or SIZE_MAX if swap is full. */
+static size_t
+zswap_alloc (size_t len) {
+	for (;;) {
+		size_t tail, ofs = SIZE_MAX;
+
+		if (list_empty (&arena_list))
+			arena_head = 0;
+		tail = list_empty (&arena_list) ? ZSWAP_SIZE : list_entry (
+				list_front (&arena_list), struct zswap_entry, elem)->ofs;
+
+		if (arena_head <= tail) {
+			/* Wrapped around, or empty: free space is [head, tail). */
+			if (tail - arena_head >= len)
+				ofs = arena_head;
+		} else if (ZSWAP_SIZE - arena_head >= len)
+			ofs = arena_head;
+		else if (tail >= len)
+			ofs = 0;
+
+		if (ofs != SIZE_MAX) {
+			arena_head = ofs + len;
+			return ofs;
+		}
+		if (!zswap_writeback ())
+			return SIZE_MAX;
+	}
+}
+
+/* Compresses the page at KVA into the arena, for PAGE. Returns the new
+ * entry, or NULL if the page does not compress well or swap is full. */
+struct zswap_entry *
+zswap_store (const void *kva, struct page *page) {
+	struct zswap_entry *e;
+	size_t len;
+
+	if (arena == NULL)
+		return NULL;
+	e = malloc (sizeof *e);
+	if (e == NULL)
+		return NULL;
+
+	lock_acquire (&zswap_lock);
+	len = lz_compress (kva, PGSIZE, zswap_buf, ZSWAP_MAX_LEN);
+	if (len == 0) {
+		rejected_cnt++;
+		goto fail;
+	}
+	e->ofs = zswap_alloc (len);
+	if (e->ofs == SIZE_MAX)
+		goto fail;
+	memcpy (arena + e->ofs, zswap_buf, len);
+	e->len = len;
+	e->refs = 1;
+	e->page = page;
+	e->slot = -1;
+	list_push_back (&arena_list, &e->elem);
+	stored_cnt++;
+	stored_bytes += len;
+	lock_release (&zswap_lock);
+	return e;
+
+fail:
+	lock_release (&zswap_lock);
+	free (e);
+	return NULL;
+}
+
+/* Adds a reference to E for another page that holds its contents, such
+ * as one that fork copied. */
+void
+zswap_dup (struct zswap_entry *e) {
+	lock_acquire (&zswap_lock);
+	e->refs++;
+	e->page = NULL;
+	/* Every reference to E passes one to its slot in the end. */
+	if (e->slot != -1)
+		swap_slot_dup (e->slot);
+	lock_release (&zswap_lock);
+}
+
+/* Drops one reference to E. Returns the swap slot E was written back to,
+ * whose reference passes to the caller, or -1. */
+static int
+zswap_put (struct zswap_entry *e) {
+	int slot = e->slot;
+
+	ASSERT (lock_held_by_current_thread (&zswap_lock));
+	if (--e->refs == 0) {
+		if (slot == -1)
+			list_remove (&e->elem);
+		free (e);
+	}
+	return slot;
+}
+
+/* Gives up a reference to E, decompressing it into KVA if it is still in
+ * the arena, in which case true is returned. Either way *SLOT is set as
+ * zswap_release() does; if false is returned, the page is to be read from
+ * that slot. */
+bool
+zswap_load (struct zswap_entry *e, void *kva, int *slot) {
+	bool loaded = false;
+
+	lock_acquire (&zswap_lock);
+	if (e->slot == -1) {
+		if (!lz_decompress (arena + e->ofs, e->len, kva, PGSIZE))
+			PANIC ("zswap: corrupted entry");
+		loaded = true;
+		hit_cnt++;
+	} else
+		miss_cnt++;
+	*slot = zswap_put (e);
+	lock_release (&zswap_lock);
+	return loaded;
+}
+
+/* Gives up a reference to E. Returns the swap slot E was written back to,
+ * whose reference passes to the caller, or -1. */
+int
+zswap_release (struct zswap_entry *e) {
+	int slot;
+
+	lock_acquire (&zswap_lock);
+	slot = zswap_put (e);
+	lock_release (&zswap_lock);
+	return slot;
+}
+
+/* Prints compression statistics. */
+void
+zswap_print_stats (void) {
+	if (arena == NULL)
+		return;
+	printf ("Zswap: %lld pages stored at %lld%% of their size, "
+			"%lld rejected\n", stored_cnt,
+			stored_cnt ? stored_bytes * 100 / (stored_cnt * PGSIZE) : 0,
+			rejected_cnt);
+	printf ("Zswap: %lld hits, %lld misses, %lld written back\n",
+			hit_cnt, miss_cnt, writeback_cnt);
+}